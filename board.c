@@ -0,0 +1,273 @@
+#include <dirent.h>
+#include <errno.h>
+#include <signal.h>
+#include <string.h>
+
+#include "board.h"
+
+static struct Board *g_board = NULL;
+
+/*
+ * Create and map the board of the shell with the given pid.
+ *
+ * If shared memory is unavailable, return NULL. Every other board function
+ * accepts NULL and does nothing, so the shell runs unmonitored.
+ */
+struct Board *openBoard(pid_t pid) {
+    char name[64];
+    struct Board *board;
+    int fd = -1;
+
+    removeStaleBoards();
+    getBoardName(pid, name, sizeof(name));
+    fd = shm_open(name, O_CREAT | O_RDWR | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd == -1) {
+        return NULL;
+    }
+    if (ftruncate(fd, sizeof(struct Board)) == -1) {
+        close(fd);
+        shm_unlink(name);
+        return NULL;
+    }
+
+    board = mmap(NULL, sizeof(struct Board), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (board == MAP_FAILED) {
+        shm_unlink(name);
+        return NULL;
+    }
+
+    board->version = BOARD_VERSION;
+    board->shellPid = pid;
+    board->updatedAt = time(NULL);
+    __atomic_store_n(&(board->magic), BOARD_MAGIC, __ATOMIC_RELEASE);
+    g_board = board;
+
+    return board;
+}
+
+/*
+ * Remove the boards that shells which were killed left behind, i.e. those
+ * whose pid no longer exists.
+ */
+void removeStaleBoards(void) {
+    struct dirent *entry;
+    char name[64];
+    char *end;
+    DIR *dir = opendir("/dev/shm");
+    long pid = 0;
+
+    if (dir == NULL) {
+        return;
+    }
+    while ((entry = readdir(dir)) != NULL) {
+        if (strncmp(entry->d_name, "smallsh.", 8) != 0) {
+            continue;
+        }
+        pid = strtol(entry->d_name + 8, &end, 10);
+        if (*end != '\0' || pid <= 0 || kill(pid, 0) == 0 || errno != ESRCH) {
+            continue;
+        }
+        getBoardName(pid, name, sizeof(name));
+        shm_unlink(name);
+    }
+    closedir(dir);
+}
+
+/*
+ * Unmap the board. The owning shell also removes the shared memory file,
+ * while a forked child only drops its mapping.
+ */
+void closeBoard(struct Board *board, pid_t pid, int isOwner) {
+    char name[64];
+
+    if (board == NULL) {
+        return;
+    }
+    if (isOwner) {
+        getBoardName(pid, name, sizeof(name));
+        shm_unlink(name);
+    }
+    if (board == g_board) {
+        g_board = NULL;
+    }
+    munmap(board, sizeof(struct Board));
+}
+
+/*
+ * Get the shm_open() name of the board of the shell with the given pid.
+ */
+void getBoardName(pid_t pid, char *name, int size) {
+    snprintf(name, size, "/smallsh.%d", pid);
+}
+
+/*
+ * Make the sequence odd before changing the board.
+ */
+void beginBoardUpdate(struct Board *board) {
+    unsigned int sequence = __atomic_load_n(&(board->sequence), __ATOMIC_RELAXED);
+    __atomic_store_n(&(board->sequence), sequence + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+/*
+ * Make the sequence even again once the board is consistent.
+ */
+void endBoardUpdate(struct Board *board) {
+    unsigned int sequence = __atomic_load_n(&(board->sequence), __ATOMIC_RELAXED);
+    board->updatedAt = time(NULL);
+    __atomic_store_n(&(board->sequence), sequence + 1, __ATOMIC_RELEASE);
+}
+
+/*
+ * Join an argument vector with spaces into dest, truncating it to size.
+ */
+void formatBoardCommand(char **argv, char *dest, int size) {
+    int length = 0;
+
+    *(dest) = '\0';
+    for (int i = 0; argv != NULL && *(argv + i) != NULL && length < size - 1; i++) {
+        length += snprintf(dest + length, size - length, i ? " %s" : "%s", *(argv + i));
+    }
+}
+
+/*
+ * Publish the foreground process, or pass a pid of 0 once it has finished.
+ */
+void setBoardForeground(struct Board *board, pid_t pid, char **argv) {
+    if (board == NULL) {
+        return;
+    }
+    beginBoardUpdate(board);
+    board->foregroundPid = pid;
+    formatBoardCommand(pid ? argv : NULL, board->foreground, BOARD_FOREGROUND_LENGTH);
+    endBoardUpdate(board);
+}
+
+/*
+ * Publish the status that the status builtin would print.
+ */
+void setBoardStatus(struct Board *board, int status, int isTimedOut) {
+    if (board == NULL || (board->status == status && board->isTimedOut == isTimedOut)) {
+        return;
+    }
+    beginBoardUpdate(board);
+    board->status = status;
+    board->isTimedOut = isTimedOut;
+    endBoardUpdate(board);
+}
+
+/*
+ * Add a background job to the board.
+ *
+ * Once the job table is full, further jobs are only counted in jobOverflow,
+ * so that jobCount is always the number of jobs in the table.
+ */
+void addBoardJob(struct Board *board, pid_t pid, char **argv) {
+    struct BoardJob *job;
+
+    if (board == NULL) {
+        return;
+    }
+    beginBoardUpdate(board);
+    if (board->jobCount < BOARD_JOB_COUNT) {
+        job = board->jobs + board->jobCount;
+        job->pid = pid;
+        formatBoardCommand(argv, job->command, BOARD_COMMAND_LENGTH);
+        board->jobCount++;
+    } else {
+        board->jobOverflow++;
+    }
+    endBoardUpdate(board);
+}
+
+/*
+ * Remove a background job from the board, moving the last job into its slot.
+ *
+ * A job that is not in the table was one of the jobs counted in jobOverflow.
+ */
+void removeBoardJob(struct Board *board, pid_t pid) {
+    int last = 0;
+    int isFound = 0;
+
+    if (board == NULL) {
+        return;
+    }
+    beginBoardUpdate(board);
+    last = board->jobCount;
+    for (int i = 0; i < last && !isFound; i++) {
+        if ((board->jobs + i)->pid == pid) {
+            *(board->jobs + i) = *(board->jobs + last - 1);
+            (board->jobs + last - 1)->pid = 0;
+            board->jobCount--;
+            isFound = 1;
+        }
+    }
+    if (!isFound && board->jobOverflow > 0) {
+        board->jobOverflow--;
+    }
+    endBoardUpdate(board);
+}
+
+/*
+ * Find the command of a background job on the board.
+ *
+ * If the job is not on the board, return NULL.
+ */
+char *findBoardJob(struct Board *board, pid_t pid) {
+    int last = 0;
+
+    if (board == NULL) {
+        return NULL;
+    }
+    last = board->jobCount;
+    for (int i = 0; i < last; i++) {
+        if ((board->jobs + i)->pid == pid) {
+            return (board->jobs + i)->command;
+        }
+    }
+
+    return NULL;
+}
+
+/*
+ * Publish the foreground-only flag.
+ *
+ * This is called from the SIGTSTP handler, so it only does an atomic store.
+ */
+void setBoardForegroundOnly(int isForegroundOnly) {
+    if (g_board != NULL) {
+        __atomic_store_n(&(g_board->isForegroundOnly), isForegroundOnly, __ATOMIC_RELAXED);
+    }
+}
+
+/*
+ * Copy a consistent snapshot of a board that may be updated concurrently.
+ *
+ * If the board is not initialized or no consistent copy could be made after
+ * a bounded number of attempts, return -1. Otherwise, return 0.
+ */
+int readBoard(struct Board *board, struct Board *snapshot) {
+    unsigned int before = 0;
+    unsigned int after = 0;
+
+    if (__atomic_load_n(&(board->magic), __ATOMIC_ACQUIRE) != BOARD_MAGIC) {
+        return -1;
+    }
+
+    for (int i = 0; i < 1000; i++) {
+        before = __atomic_load_n(&(board->sequence), __ATOMIC_ACQUIRE);
+        if (before & 1) {
+            continue;
+        }
+        *snapshot = *board;
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        after = __atomic_load_n(&(board->sequence), __ATOMIC_RELAXED);
+        if (before == after) {
+            snapshot->isForegroundOnly = __atomic_load_n(&(board->isForegroundOnly), __ATOMIC_RELAXED);
+            return snapshot->version == BOARD_VERSION ? 0 : -1;
+        }
+    }
+
+    return -1;
+}
\ No newline at end of file
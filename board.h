@@ -0,0 +1,82 @@
+#ifndef BOARD_H
+#define BOARD_H
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <time.h>
+#include <unistd.h>
+
+/*
+ * The board file publishes the live state of a smallsh process to a shared
+ * memory file, /dev/shm/smallsh.<pid>, for external monitoring.
+ *
+ * The shell is the only writer. Every update is wrapped in a seqlock: the
+ * sequence is odd while an update is in progress, so readers copy the board
+ * and retry if the sequence was odd or changed meanwhile. Readers never block
+ * the shell. The foreground-only flag is the exception, as it is toggled by
+ * the SIGTSTP handler, which must not enter the seqlock; it is a single
+ * atomically stored int instead.
+ */
+
+enum BoardSize {
+    BOARD_MAGIC = 0x736d6c62,
+    BOARD_VERSION = 2,
+    BOARD_JOB_COUNT = 256,
+    BOARD_COMMAND_LENGTH = 60,
+    BOARD_FOREGROUND_LENGTH = 256
+};
+
+struct BoardJob {
+    int pid;
+    char command[BOARD_COMMAND_LENGTH];
+};
+
+struct Board {
+    unsigned int magic;
+    unsigned int version;
+    unsigned int sequence;
+    int isForegroundOnly;
+    int shellPid;
+    int foregroundPid;
+    int status;
+    int isTimedOut;
+    int jobCount;
+    int jobOverflow;
+    long updatedAt;
+    char foreground[BOARD_FOREGROUND_LENGTH];
+    struct BoardJob jobs[BOARD_JOB_COUNT];
+};
+
+struct Board *openBoard(pid_t pid);
+
+void removeStaleBoards(void);
+
+void closeBoard(struct Board *board, pid_t pid, int isOwner);
+
+void getBoardName(pid_t pid, char *name, int size);
+
+void beginBoardUpdate(struct Board *board);
+
+void endBoardUpdate(struct Board *board);
+
+void formatBoardCommand(char **argv, char *dest, int size);
+
+void setBoardForeground(struct Board *board, pid_t pid, char **argv);
+
+void setBoardStatus(struct Board *board, int status, int isTimedOut);
+
+void addBoardJob(struct Board *board, pid_t pid, char **argv);
+
+void removeBoardJob(struct Board *board, pid_t pid);
+
+char *findBoardJob(struct Board *board, pid_t pid);
+
+void setBoardForegroundOnly(int isForegroundOnly);
+
+int readBoard(struct Board *board, struct Board *snapshot);
+
+#endif
\ No newline at end of file
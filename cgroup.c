@@ -0,0 +1,511 @@
+#include <dirent.h>
+#include <signal.h>
+
+#include "cgroup.h"
+#include "util.h"
+
+/*
+ * Create the cgroup subtree of the shell with the given pid.
+ *
+ * Unless $SMALLSH_CGROUP is set, the subtree is created in the cgroup of the
+ * shell, so the shell moves into the leaf smallsh.<pid>/shell first, as the
+ * controllers of the subtree cannot be enabled while the shell is there.
+ * Controllers are enabled one at a time, so that a controller the parent
+ * does not delegate only disables its own limit. The controllers that were
+ * enabled in the root by this shell, rather than before it, are recorded in
+ * rootControllers, one bit per controller, so that only those are disabled
+ * again. If no subtree could be created, the returned cgroup has a NULL path
+ * and jobs run unconfined.
+ */
+struct Cgroup *openCgroup(pid_t pid) {
+    MEMSTATS_SCOPE(MEMSTATS_JOBS);
+    struct Cgroup *cgroup = malloc(sizeof(struct Cgroup));
+    char *controllers[3] = {"memory", "cpu", "io"};
+    char *override = getenv("SMALLSH_CGROUP");
+    char root[4096];
+    char name[64];
+    char value[64];
+
+    cgroup->path = NULL;
+    cgroup->root = NULL;
+    cgroup->shell = NULL;
+    cgroup->rootControllers = malloc(sizeof(int));
+    *(cgroup->rootControllers) = 0;
+    cgroup->limits = copyLimits(NULL);
+    if (findCgroupRoot(root, sizeof(root)) == -1) {
+        return cgroup;
+    }
+    removeStaleCgroups(root);
+
+    snprintf(name, sizeof(name), "smallsh.%d", pid);
+    cgroup->path = joinPath(root, name);
+    if (mkdir(cgroup->path, 0755) == -1 && errno != EEXIST) {
+        free(cgroup->path);
+        cgroup->path = NULL;
+        return cgroup;
+    }
+    cgroup->root = malloc(sizeof(char) * (stringLength(root) + 1));
+    copyString(root, cgroup->root);
+
+    if (override == NULL || *override == '\0') {
+        cgroup->shell = joinPath(cgroup->path, "shell");
+        snprintf(name, sizeof(name), "%d", pid);
+        if ((mkdir(cgroup->shell, 0755) == -1 && errno != EEXIST) || writeCgroupFile(cgroup->shell, "cgroup.procs", name) == -1) {
+            rmdir(cgroup->shell);
+            free(cgroup->shell);
+            cgroup->shell = NULL;
+        }
+    }
+
+    for (int i = 0; i < 3; i++) {
+        snprintf(value, sizeof(value), "+%s", *(controllers + i));
+        if (!hasSubtreeController(root, *(controllers + i)) && writeCgroupFile(root, "cgroup.subtree_control", value) == 0) {
+            *(cgroup->rootControllers) |= 1 << i;
+        }
+        writeCgroupFile(cgroup->path, "cgroup.subtree_control", value);
+    }
+
+    return cgroup;
+}
+
+/*
+ * Free a cgroup struct. The owning shell also removes the leaves that are
+ * left and the subtree itself, while a forked child only frees its copy.
+ *
+ * The controllers that the shell enabled in the root are disabled again,
+ * which also lets a shell that moved into its own leaf move back to the
+ * cgroup it came from. Controllers that were enabled before are left alone.
+ *
+ * A leaf that still holds a process cannot be removed, and is left behind.
+ */
+void closeCgroup(struct Cgroup *cgroup, int isOwner) {
+    char *controllers[3] = {"memory", "cpu", "io"};
+    struct dirent *entry;
+    char value[64];
+    char *leaf;
+    DIR *dir;
+
+    if (isOwner && cgroup->path != NULL && (dir = opendir(cgroup->path)) != NULL) {
+        while ((entry = readdir(dir)) != NULL) {
+            if (strncmp(entry->d_name, "job.", 4) == 0) {
+                leaf = joinPath(cgroup->path, entry->d_name);
+                rmdir(leaf);
+                free(leaf);
+            }
+        }
+        closedir(dir);
+        for (int i = 2; i >= 0; i--) {
+            snprintf(value, sizeof(value), "-%s", *(controllers + i));
+            writeCgroupFile(cgroup->path, "cgroup.subtree_control", value);
+            if (*(cgroup->rootControllers) & (1 << i)) {
+                writeCgroupFile(cgroup->root, "cgroup.subtree_control", value);
+            }
+        }
+        if (cgroup->shell != NULL) {
+            snprintf(value, sizeof(value), "%d", getpid());
+            writeCgroupFile(cgroup->root, "cgroup.procs", value);
+            rmdir(cgroup->shell);
+        }
+        rmdir(cgroup->path);
+    }
+    free(cgroup->path);
+    free(cgroup->root);
+    free(cgroup->shell);
+    free(cgroup->rootControllers);
+    freeLimits(cgroup->limits);
+    free(cgroup);
+}
+
+/*
+ * Remove the subtrees that shells which were killed left behind in root.
+ *
+ * A subtree smallsh.<pid> is stale once no process has its pid. Its leaves
+ * are removed first, and a leaf that still holds a job that outlived its
+ * shell is left behind, along with the subtree.
+ */
+void removeStaleCgroups(char *root) {
+    struct dirent *entry;
+    struct dirent *child;
+    char *subtree;
+    char *leaf;
+    char *end;
+    DIR *dir = opendir(root);
+    DIR *leaves;
+    long pid = 0;
+
+    if (dir == NULL) {
+        return;
+    }
+    while ((entry = readdir(dir)) != NULL) {
+        if (strncmp(entry->d_name, "smallsh.", 8) != 0) {
+            continue;
+        }
+        pid = strtol(entry->d_name + 8, &end, 10);
+        if (*end != '\0' || pid <= 0 || kill(pid, 0) == 0 || errno != ESRCH) {
+            continue;
+        }
+        subtree = joinPath(root, entry->d_name);
+        if ((leaves = opendir(subtree)) != NULL) {
+            while ((child = readdir(leaves)) != NULL) {
+                if (strncmp(child->d_name, "job.", 4) == 0 || isEqualString(child->d_name, "shell")) {
+                    leaf = joinPath(subtree, child->d_name);
+                    rmdir(leaf);
+                    free(leaf);
+                }
+            }
+            closedir(leaves);
+        }
+        rmdir(subtree);
+        free(subtree);
+    }
+    closedir(dir);
+}
+
+/*
+ * Find the cgroup v2 directory to create the subtree in.
+ *
+ * This is $SMALLSH_CGROUP if it is set. Otherwise, it is the cgroup of the
+ * shell, found by joining the cgroup2 mount point from /proc/self/mounts with
+ * the unified entry of /proc/self/cgroup.
+ *
+ * If there is no writable directory, return -1. Otherwise, return 0.
+ */
+int findCgroupRoot(char *root, int size) {
+    char *override = getenv("SMALLSH_CGROUP");
+    char line[4096];
+    char mount[4096];
+    char type[64];
+    FILE *file;
+    int isFound = 0;
+
+    if (override != NULL && *override != '\0') {
+        snprintf(root, size, "%s", override);
+        return access(root, W_OK) == 0 ? 0 : -1;
+    }
+
+    file = fopen("/proc/self/mounts", "re");
+    if (file == NULL) {
+        return -1;
+    }
+    while (!isFound && fgets(line, sizeof(line), file) != NULL) {
+        if (sscanf(line, "%*s %4095s %63s", mount, type) == 2 && isEqualString(type, "cgroup2")) {
+            isFound = 1;
+        }
+    }
+    fclose(file);
+    if (!isFound) {
+        return -1;
+    }
+
+    file = fopen("/proc/self/cgroup", "re");
+    if (file == NULL) {
+        return -1;
+    }
+    isFound = 0;
+    while (!isFound && fgets(line, sizeof(line), file) != NULL) {
+        if (strncmp(line, "0::", 3) == 0) {
+            *(line + strcspn(line, "\n")) = '\0';
+            snprintf(root, size, "%s%s", mount, isEqualString(line + 3, "/") ? "" : line + 3);
+            isFound = 1;
+        }
+    }
+    fclose(file);
+
+    return isFound && access(root, W_OK) == 0 ? 0 : -1;
+}
+
+/*
+ * Write value to the control file name in directory.
+ *
+ * If the write fails, return -1. Otherwise, return 0.
+ */
+int writeCgroupFile(char *directory, char *name, char *value) {
+    char *path = joinPath(directory, name);
+    int length = stringLength(value);
+    int fd = open(path, O_WRONLY | O_CLOEXEC);
+    int result = -1;
+
+    free(path);
+    if (fd == -1) {
+        return -1;
+    }
+    if (write(fd, value, length) == length) {
+        result = 0;
+    }
+    close(fd);
+
+    return result;
+}
+
+/*
+ * Read the control file name in directory into a null-terminated buffer.
+ *
+ * If the read fails, return -1. Otherwise, return the number of characters
+ * read.
+ */
+int readCgroupFile(char *directory, char *name, char *buffer, int size) {
+    char *path = joinPath(directory, name);
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    int length = -1;
+
+    free(path);
+    if (fd == -1) {
+        return -1;
+    }
+    length = read(fd, buffer, size - 1);
+    close(fd);
+    if (length == -1) {
+        return -1;
+    }
+    *(buffer + length) = '\0';
+
+    return length;
+}
+
+/*
+ * Check whether a controller is enabled for the leaves of the subtree.
+ *
+ * If it is, return 1. Otherwise, return 0.
+ */
+int hasCgroupController(struct Cgroup *cgroup, char *controller) {
+    return cgroup->path != NULL && hasSubtreeController(cgroup->path, controller);
+}
+
+/*
+ * Check whether a controller is enabled in the cgroup.subtree_control file
+ * of a directory.
+ *
+ * If it is, return 1. Otherwise, return 0.
+ */
+int hasSubtreeController(char *directory, char *controller) {
+    char buffer[512];
+    char *word;
+    char *saveptr;
+
+    if (readCgroupFile(directory, "cgroup.subtree_control", buffer, sizeof(buffer)) == -1) {
+        return 0;
+    }
+    for (word = strtok_r(buffer, " \n", &saveptr); word != NULL; word = strtok_r(NULL, " \n", &saveptr)) {
+        if (isEqualString(word, controller)) {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+/*
+ * Copy a limits struct. If limits is NULL, return limits that leave every
+ * resource unlimited.
+ */
+struct Limits *copyLimits(struct Limits *limits) {
+    MEMSTATS_SCOPE(MEMSTATS_JOBS);
+    struct Limits *copy = malloc(sizeof(struct Limits));
+    copy->memoryMax = malloc(sizeof(long));
+    copy->cpuPercent = malloc(sizeof(int));
+    *(copy->memoryMax) = limits != NULL ? *(limits->memoryMax) : 0;
+    *(copy->cpuPercent) = limits != NULL ? *(limits->cpuPercent) : 0;
+    copy->io = NULL;
+    if (limits != NULL && limits->io != NULL) {
+        copy->io = malloc(sizeof(char) * (stringLength(limits->io) + 1));
+        copyString(limits->io, copy->io);
+    }
+
+    return copy;
+}
+
+/*
+ * Free all memory in a limits struct.
+ */
+void freeLimits(struct Limits *limits) {
+    if (limits == NULL) {
+        return;
+    }
+    free(limits->memoryMax);
+    free(limits->cpuPercent);
+    free(limits->io);
+    free(limits);
+}
+
+/*
+ * Check whether a word is a limit, i.e. starts with mem=, cpu= or io=.
+ *
+ * If it is, return 1. Otherwise, return 0.
+ */
+int isLimit(char *word) {
+    return strncmp(word, "mem=", 4) == 0 || strncmp(word, "cpu=", 4) == 0 || strncmp(word, "io=", 3) == 0;
+}
+
+/*
+ * Apply a single limit to a limits struct.
+ *
+ * mem=SIZE         memory.max, e.g. mem=2G
+ * cpu=PERCENT      cpu.max as a percentage of one CPU, e.g. cpu=50%
+ * io=MAJ:MIN:RATE  io.max read and write bandwidth of one block device,
+ *                  e.g. io=8:0:10M
+ *
+ * A value of max removes the limit.
+ *
+ * If the limit is malformed, return -1. Otherwise, return 0.
+ */
+int parseLimit(struct Limits *limits, char *word) {
+    char *value = strchr(word, '=') + 1;
+    unsigned int major = 0;
+    unsigned int minor = 0;
+    char rate[64];
+    char *end;
+    long number = 0;
+
+    if (isEqualString(value, "max")) {
+        number = 0;
+    } else if (*word == 'm') {
+        number = parseSize(value);
+    } else if (*word == 'c') {
+        number = strtol(value, &end, 10);
+        if (end == value || !(isEqualString(end, "%") || isEqualString(end, "")) || number <= 0) {
+            number = -1;
+        }
+    } else if (sscanf(value, "%u:%u:%63s", &major, &minor, rate) != 3 || parseSize(rate) <= 0) {
+        number = -1;
+    }
+    if (number < 0) {
+        return -1;
+    }
+
+    if (*word == 'm') {
+        *(limits->memoryMax) = number;
+    } else if (*word == 'c') {
+        *(limits->cpuPercent) = number;
+    } else {
+        free(limits->io);
+        limits->io = NULL;
+        if (!isEqualString(value, "max")) {
+            limits->io = malloc(sizeof(char) * (stringLength(value) + 1));
+            copyString(value, limits->io);
+        }
+    }
+
+    return 0;
+}
+
+/*
+ * Print limits in the form accepted by parseLimit().
+ */
+void printLimits(struct Limits *limits) {
+    if (*(limits->memoryMax)) {
+        printf("mem=%ld ", *(limits->memoryMax));
+    } else {
+        printf("mem=max ");
+    }
+    if (*(limits->cpuPercent)) {
+        printf("cpu=%d%% ", *(limits->cpuPercent));
+    } else {
+        printf("cpu=max ");
+    }
+    printf("io=%s\n", limits->io != NULL ? limits->io : "max");
+    fflush(stdout);
+}
+
+/*
+ * Create the leaf of a job, write its limits and move the job into it.
+ *
+ * The job must not exec before this returns, so that it cannot escape its
+ * limits. Limits whose controller is unavailable are skipped, as limit
+ * already warned about them, and limits that cannot be written are reported.
+ *
+ * If the job could not be moved into a leaf, return -1. Otherwise, return 0.
+ */
+int addCgroupJob(struct Cgroup *cgroup, struct Limits *limits, pid_t pid) {
+    unsigned int major = 0;
+    unsigned int minor = 0;
+    long bandwidth = 0;
+    char value[128];
+    char rate[64];
+    char name[64];
+    char *leaf;
+    int result = 0;
+
+    if (cgroup->path == NULL) {
+        return -1;
+    }
+    snprintf(name, sizeof(name), "job.%d", pid);
+    leaf = joinPath(cgroup->path, name);
+    if (mkdir(leaf, 0755) == -1 && errno != EEXIST) {
+        free(leaf);
+        return -1;
+    }
+
+    if (*(limits->memoryMax) && hasCgroupController(cgroup, "memory")) {
+        snprintf(value, sizeof(value), "%ld", *(limits->memoryMax));
+        writeJobLimit(leaf, "memory.max", value, pid);
+    }
+    if (*(limits->cpuPercent) && hasCgroupController(cgroup, "cpu")) {
+        snprintf(value, sizeof(value), "%d 100000", *(limits->cpuPercent) * 1000);
+        writeJobLimit(leaf, "cpu.max", value, pid);
+    }
+    if (limits->io != NULL && hasCgroupController(cgroup, "io") && sscanf(limits->io, "%u:%u:%63s", &major, &minor, rate) == 3) {
+        bandwidth = parseSize(rate);
+        snprintf(value, sizeof(value), "%u:%u rbps=%ld wbps=%ld", major, minor, bandwidth, bandwidth);
+        writeJobLimit(leaf, "io.max", value, pid);
+    }
+
+    snprintf(value, sizeof(value), "%d", pid);
+    result = writeCgroupFile(leaf, "cgroup.procs", value);
+    if (result == -1) {
+        rmdir(leaf);
+    }
+    free(leaf);
+
+    return result;
+}
+
+/*
+ * Write one limit of a job to its leaf, and report it if the write fails.
+ */
+void writeJobLimit(char *leaf, char *name, char *value, pid_t pid) {
+    if (writeCgroupFile(leaf, name, value) == -1) {
+        fprintf(stderr, "limit: could not set %s of pid %d: %s\n", name, pid, strerror(errno));
+    }
+}
+
+/*
+ * Remove the leaf of a reaped job.
+ */
+void removeCgroupJob(struct Cgroup *cgroup, pid_t pid) {
+    char name[64];
+    char *leaf;
+
+    if (cgroup->path == NULL) {
+        return;
+    }
+    snprintf(name, sizeof(name), "job.%d", pid);
+    leaf = joinPath(cgroup->path, name);
+    rmdir(leaf);
+    free(leaf);
+}
+
+/*
+ * Read the peak memory usage in bytes and the CPU time in microseconds of a
+ * job. Values that are unavailable are set to -1.
+ */
+void readCgroupJob(struct Cgroup *cgroup, pid_t pid, long *memoryPeak, long *cpuUsage) {
+    char buffer[1024];
+    char name[64];
+    char *usage;
+    char *leaf;
+
+    *memoryPeak = -1;
+    *cpuUsage = -1;
+    if (cgroup->path == NULL) {
+        return;
+    }
+    snprintf(name, sizeof(name), "job.%d", pid);
+    leaf = joinPath(cgroup->path, name);
+    if (readCgroupFile(leaf, "memory.peak", buffer, sizeof(buffer)) > 0) {
+        *memoryPeak = atol(buffer);
+    }
+    if (readCgroupFile(leaf, "cpu.stat", buffer, sizeof(buffer)) > 0 && (usage = strstr(buffer, "usage_usec ")) != NULL) {
+        *cpuUsage = atol(usage + 11);
+    }
+    free(leaf);
+}
@@ -0,0 +1,80 @@
+#ifndef CGROUP_H
+#define CGROUP_H
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "memstats.h"
+
+/*
+ * The cgroup file confines the jobs of smallsh with cgroup v2.
+ *
+ * The shell creates a subtree, smallsh.<pid>, under $SMALLSH_CGROUP if it is
+ * set, or else under its own cgroup, and enables the memory, cpu and io
+ * controllers there when the parent delegates them. As cgroup v2 does not
+ * enable controllers for the children of a cgroup that holds processes, the
+ * shell first moves itself out of its own cgroup into the leaf
+ * smallsh.<pid>/shell, and moves back when it exits. $SMALLSH_CGROUP must
+ * not hold processes for the same reason. Every job gets its own leaf,
+ * job.<pid>, whose limits are written before the job is allowed to exec. The
+ * leaf is removed once the job is reaped.
+ *
+ * If no cgroup v2 hierarchy is writable, every function accepts the
+ * unavailable cgroup and does nothing, so jobs run unconfined.
+ */
+
+struct Limits {
+    long *memoryMax;
+    int *cpuPercent;
+    char *io;
+};
+
+struct Cgroup {
+    char *path;
+    char *root;
+    char *shell;
+    int *rootControllers;
+    struct Limits *limits;
+};
+
+struct Cgroup *openCgroup(pid_t pid);
+
+void closeCgroup(struct Cgroup *cgroup, int isOwner);
+
+void removeStaleCgroups(char *root);
+
+int findCgroupRoot(char *root, int size);
+
+int writeCgroupFile(char *directory, char *name, char *value);
+
+int readCgroupFile(char *directory, char *name, char *buffer, int size);
+
+int hasCgroupController(struct Cgroup *cgroup, char *controller);
+
+int hasSubtreeController(char *directory, char *controller);
+
+struct Limits *copyLimits(struct Limits *limits);
+
+void freeLimits(struct Limits *limits);
+
+int isLimit(char *word);
+
+int parseLimit(struct Limits *limits, char *word);
+
+void printLimits(struct Limits *limits);
+
+int addCgroupJob(struct Cgroup *cgroup, struct Limits *limits, pid_t pid);
+
+void writeJobLimit(char *leaf, char *name, char *value, pid_t pid);
+
+void removeCgroupJob(struct Cgroup *cgroup, pid_t pid);
+
+void readCgroupJob(struct Cgroup *cgroup, pid_t pid, long *memoryPeak, long *cpuUsage);
+
+#endif
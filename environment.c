@@ -0,0 +1,297 @@
+#include "environment.h"
+#include "util.h"
+
+/*
+ * Initialize an environment structure from a null-terminated envp vector.
+ */
+void initEnvironment(struct Environment *environment, char **envp) {
+    MEMSTATS_SCOPE(MEMSTATS_ENVIRONMENT);
+    environment->bucketCount = malloc(sizeof(int));
+    environment->variableCount = malloc(sizeof(int));
+    environment->isDirty = malloc(sizeof(int));
+    environment->size = malloc(sizeof(long));
+    *(environment->bucketCount) = 64;
+    *(environment->variableCount) = 0;
+    *(environment->isDirty) = 1;
+    *(environment->size) = 0;
+    environment->buckets = calloc(*(environment->bucketCount), sizeof(struct Variable*));
+    environment->envp = malloc(sizeof(char*));
+    *(environment->envp) = NULL;
+
+    for (int i = 0; *(envp + i) != NULL; i++) {
+        if (getVariableNameLength(*(envp + i)) > 0) {
+            setVariable(environment, *(envp + i));
+        }
+    }
+}
+
+/*
+ * Free all memory in an environment struct.
+ */
+void freeEnvironment(struct Environment *environment) {
+    struct Variable *variable;
+    struct Variable *next;
+
+    for (int i = 0; i < *(environment->bucketCount); i++) {
+        variable = *(environment->buckets + i);
+        while (variable != NULL) {
+            next = variable->next;
+            free(variable->entry);
+            free(variable);
+            variable = next;
+        }
+    }
+    free(environment->buckets);
+    free(environment->bucketCount);
+    free(environment->variableCount);
+    free(environment->isDirty);
+    free(environment->size);
+    free(environment->envp);
+    free(environment);
+}
+
+/*
+ * Hash the first nameLength characters of name with FNV-1a.
+ */
+unsigned int hashVariableName(char *name, int nameLength) {
+    unsigned int hash = 2166136261u;
+    for (int i = 0; i < nameLength; i++) {
+        hash ^= (unsigned char) *(name + i);
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+/*
+ * Get the length of the name in a NAME=value entry.
+ *
+ * If the entry has no equals sign, the whole entry is the name.
+ */
+int getVariableNameLength(char *entry) {
+    int length = 0;
+    while (*(entry + length) != '\0' && *(entry + length) != '=') {
+        length++;
+    }
+    return length;
+}
+
+/*
+ * Check if a word is a NAME=value assignment.
+ *
+ * If the word is an assignment, return 1. Otherwise, return 0.
+ */
+int isAssignment(char *word) {
+    int nameLength = getVariableNameLength(word);
+    if (*(word + nameLength) != '=') {
+        return 0;
+    }
+    return isVariableName(word, nameLength);
+}
+
+/*
+ * Check if the first nameLength characters of name form a valid name.
+ *
+ * The name must be non-empty, must not start with a digit, and may only
+ * contain letters, digits and underscores.
+ *
+ * If the name is valid, return 1. Otherwise, return 0.
+ */
+int isVariableName(char *name, int nameLength) {
+    char ch = '\0';
+
+    if (nameLength == 0 || (*(name) >= '0' && *(name) <= '9')) {
+        return 0;
+    }
+    for (int i = 0; i < nameLength; i++) {
+        ch = *(name + i);
+        if (!((ch >= 'a' && ch <= 'z') || (ch >= 'A' && ch <= 'Z') ||\
+        (ch >= '0' && ch <= '9') || ch == '_')) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/*
+ * Find the variable whose name matches the first nameLength characters of
+ * name.
+ *
+ * If no such variable exists, return NULL.
+ */
+struct Variable *findVariable(struct Environment *environment, char *name, int nameLength) {
+    unsigned int hash = hashVariableName(name, nameLength);
+    struct Variable *variable = *(environment->buckets + hash % *(environment->bucketCount));
+
+    while (variable != NULL) {
+        if (variable->nameLength == nameLength &&\
+        strncmp(variable->entry, name, nameLength) == 0) {
+            return variable;
+        }
+        variable = variable->next;
+    }
+    return NULL;
+}
+
+/*
+ * Set a variable from a NAME=value entry, replacing any previous value.
+ *
+ * The entry is copied, so the caller keeps ownership of it.
+ */
+void setVariable(struct Environment *environment, char *entry) {
+    MEMSTATS_SCOPE(MEMSTATS_ENVIRONMENT);
+    int nameLength = getVariableNameLength(entry);
+    unsigned int hash = hashVariableName(entry, nameLength);
+    struct Variable *variable = findVariable(environment, entry, nameLength);
+    struct Variable **bucket;
+
+    if (variable == NULL) {
+        variable = malloc(sizeof(struct Variable));
+        variable->nameLength = nameLength;
+        variable->index = -1;
+        bucket = environment->buckets + hash % *(environment->bucketCount);
+        variable->next = *bucket;
+        *bucket = variable;
+        *(environment->variableCount) += 1;
+    } else {
+        free(variable->entry);
+    }
+
+    variable->entry = malloc(sizeof(char) * (stringLength(entry) + 1));
+    copyString(entry, variable->entry);
+    *(environment->isDirty) = 1;
+
+    if (*(environment->variableCount) > *(environment->bucketCount)) {
+        resizeEnvironment(environment);
+    }
+}
+
+/*
+ * Remove the variable with the given name, if it exists.
+ */
+void unsetVariable(struct Environment *environment, char *name) {
+    int nameLength = getVariableNameLength(name);
+    unsigned int hash = hashVariableName(name, nameLength);
+    struct Variable **link = environment->buckets + hash % *(environment->bucketCount);
+    struct Variable *variable;
+
+    while (*link != NULL) {
+        variable = *link;
+        if (variable->nameLength == nameLength &&\
+        strncmp(variable->entry, name, nameLength) == 0) {
+            *link = variable->next;
+            free(variable->entry);
+            free(variable);
+            *(environment->variableCount) -= 1;
+            *(environment->isDirty) = 1;
+            return;
+        }
+        link = &(variable->next);
+    }
+}
+
+/*
+ * Double the number of buckets and rehash every variable.
+ */
+void resizeEnvironment(struct Environment *environment) {
+    MEMSTATS_SCOPE(MEMSTATS_ENVIRONMENT);
+    int bucketCount = *(environment->bucketCount) * 2;
+    struct Variable **buckets = calloc(bucketCount, sizeof(struct Variable*));
+    struct Variable *variable;
+    struct Variable *next;
+    unsigned int hash = 0;
+
+    for (int i = 0; i < *(environment->bucketCount); i++) {
+        variable = *(environment->buckets + i);
+        while (variable != NULL) {
+            next = variable->next;
+            hash = hashVariableName(variable->entry, variable->nameLength);
+            variable->next = *(buckets + hash % bucketCount);
+            *(buckets + hash % bucketCount) = variable;
+            variable = next;
+        }
+    }
+
+    free(environment->buckets);
+    environment->buckets = buckets;
+    *(environment->bucketCount) = bucketCount;
+}
+
+/*
+ * Get the envp vector to pass to exec.
+ *
+ * The vector is only rebuilt if a variable changed since the last call, so
+ * launching a command does not cost work proportional to the environment
+ * size. Each variable remembers its index in the vector, which lets
+ * getOverrideVector() replace entries without searching.
+ */
+char **getEnvironmentVector(struct Environment *environment) {
+    MEMSTATS_SCOPE(MEMSTATS_ENVIRONMENT);
+    struct Variable *variable;
+    int index = 0;
+
+    if (!*(environment->isDirty)) {
+        return environment->envp;
+    }
+
+    environment->envp = realloc(environment->envp, sizeof(char*) * (*(environment->variableCount) + 1));
+    *(environment->size) = sizeof(char*);
+
+    for (int i = 0; i < *(environment->bucketCount); i++) {
+        variable = *(environment->buckets + i);
+        while (variable != NULL) {
+            variable->index = index;
+            *(environment->envp + index) = variable->entry;
+            *(environment->size) += stringLength(variable->entry) + 1 + sizeof(char*);
+            index++;
+            variable = variable->next;
+        }
+    }
+    *(environment->envp + index) = NULL;
+    *(environment->isDirty) = 0;
+
+    return environment->envp;
+}
+
+/*
+ * Get an envp vector with count NAME=value overrides applied.
+ *
+ * The vector is a shallow copy of the cached vector in which the overridden
+ * entries are replaced in place, and new names are appended. The entries are
+ * borrowed, so the caller only frees the returned vector itself.
+ */
+char **getOverrideVector(struct Environment *environment, char **overrides, int count) {
+    MEMSTATS_SCOPE(MEMSTATS_ENVIRONMENT);
+    char **envp = getEnvironmentVector(environment);
+    int variableCount = *(environment->variableCount);
+    int appended = 0;
+    int nameLength = 0;
+    int isReplaced = 0;
+    char **result = malloc(sizeof(char*) * (variableCount + count + 1));
+    struct Variable *variable;
+
+    memcpy(result, envp, sizeof(char*) * variableCount);
+
+    for (int i = 0; i < count; i++) {
+        nameLength = getVariableNameLength(*(overrides + i));
+        variable = findVariable(environment, *(overrides + i), nameLength);
+        if (variable != NULL) {
+            *(result + variable->index) = *(overrides + i);
+            continue;
+        }
+        isReplaced = 0;
+        for (int j = variableCount; j < variableCount + appended; j++) {
+            if (strncmp(*(result + j), *(overrides + i), nameLength + 1) == 0) {
+                *(result + j) = *(overrides + i);
+                isReplaced = 1;
+                break;
+            }
+        }
+        if (!isReplaced) {
+            *(result + variableCount + appended) = *(overrides + i);
+            appended++;
+        }
+    }
+    *(result + variableCount + appended) = NULL;
+
+    return result;
+}
\ No newline at end of file
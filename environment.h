@@ -0,0 +1,57 @@
+#ifndef ENVIRONMENT_H
+#define ENVIRONMENT_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "memstats.h"
+
+/*
+ * The environment file contains the exported variables of smallsh.
+ *
+ * Variables are stored in a hash map keyed by name. The envp vector passed to
+ * exec is cached, and only rebuilt after a variable is set or unset.
+ */
+
+struct Variable {
+    char *entry;
+    int nameLength;
+    int index;
+    struct Variable *next;
+};
+
+struct Environment {
+    struct Variable **buckets;
+    int *bucketCount;
+    int *variableCount;
+    int *isDirty;
+    long *size;
+    char **envp;
+};
+
+void initEnvironment(struct Environment *environment, char **envp);
+
+void freeEnvironment(struct Environment *environment);
+
+unsigned int hashVariableName(char *name, int nameLength);
+
+int getVariableNameLength(char *entry);
+
+int isAssignment(char *word);
+
+int isVariableName(char *name, int nameLength);
+
+struct Variable *findVariable(struct Environment *environment, char *name, int nameLength);
+
+void setVariable(struct Environment *environment, char *entry);
+
+void unsetVariable(struct Environment *environment, char *name);
+
+void resizeEnvironment(struct Environment *environment);
+
+char **getEnvironmentVector(struct Environment *environment);
+
+char **getOverrideVector(struct Environment *environment, char **overrides, int count);
+
+#endif
\ No newline at end of file
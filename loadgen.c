@@ -0,0 +1,599 @@
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+/*
+ * The loadgen file drives many concurrent smallsh sessions and reports the
+ * latency from sending a command line to the next prompt.
+ *
+ * Each session runs on a pair of pipes or, with -p, on a pty. A single poll
+ * loop sends every session one command at a time, picked at random from a
+ * weighted command mix, and records each latency in a histogram with log2
+ * buckets of 1024 linear sub-buckets, i.e. three significant digits.
+ */
+
+struct Mix {
+    int weight;
+    char *line;
+};
+
+struct Session {
+    pid_t pid;
+    int inFd;
+    int outFd;
+    int remaining;
+    int isWaiting;
+    int isStarted;
+    int isAtLineStart;
+    int isColon;
+    long sentAt;
+};
+
+struct Histogram {
+    long *counts;
+    long total;
+    long min;
+    long max;
+    double sum;
+};
+
+const int SUB_BUCKET_BITS = 10;
+const int BUCKET_COUNT = 54;
+
+long getMonotonicMicroseconds(void);
+
+void printUsage(char *name);
+
+int parseMix(char *spec, struct Mix *mix, int size);
+
+int readMixFile(char *filename, struct Mix *mix, int size);
+
+char *pickMixLine(struct Mix *mix, int count, int totalWeight);
+
+int startSession(struct Session *session, char *path, int isPty);
+
+int readSession(struct Session *session);
+
+void sendSession(struct Session *session, char *line);
+
+void initHistogram(struct Histogram *histogram);
+
+int getHistogramIndex(long value);
+
+long getHistogramValue(int index);
+
+void recordHistogram(struct Histogram *histogram, long value);
+
+long getHistogramPercentile(struct Histogram *histogram, double percentile);
+
+void printHistogram(struct Histogram *histogram);
+
+/*
+ * Run the load test.
+ */
+int main(int argc, char **argv) {
+    struct Mix mix[64];
+    struct Session *sessions;
+    struct pollfd *pollfds;
+    struct Histogram histogram;
+    char *path = "./smallsh";
+    char *spec = "builtin=40,fg=40,bg=10,redir=10";
+    char *mixFile = NULL;
+    int sessionCount = 16;
+    int commandCount = 200;
+    int isPty = 0;
+    int mixCount = 0;
+    int totalWeight = 0;
+    int active = 0;
+    int errors = 0;
+    int option = 0;
+    long timeout = 10000000;
+    long startedAt = 0;
+    long elapsed = 0;
+    long now = 0;
+
+    while ((option = getopt(argc, argv, "n:c:m:f:t:ph")) != -1) {
+        switch (option) {
+            case 'n':
+                sessionCount = atoi(optarg);
+                break;
+            case 'c':
+                commandCount = atoi(optarg);
+                break;
+            case 'm':
+                spec = optarg;
+                break;
+            case 'f':
+                mixFile = optarg;
+                break;
+            case 't':
+                timeout = atol(optarg) * 1000000;
+                break;
+            case 'p':
+                isPty = 1;
+                break;
+            default:
+                printUsage(*argv);
+                return option == 'h' ? 0 : 1;
+        }
+    }
+    if (optind < argc) {
+        path = *(argv + optind);
+    }
+
+    if (mixFile != NULL) {
+        mixCount = readMixFile(mixFile, mix, sizeof(mix) / sizeof(struct Mix));
+    } else {
+        mixCount = parseMix(spec, mix, sizeof(mix) / sizeof(struct Mix));
+    }
+    for (int i = 0; i < mixCount; i++) {
+        totalWeight += (mix + i)->weight;
+    }
+    if (sessionCount < 1 || commandCount < 1 || mixCount < 1 || totalWeight < 1) {
+        printUsage(*argv);
+        return 1;
+    }
+
+    signal(SIGPIPE, SIG_IGN);
+    srand(getpid());
+    initHistogram(&histogram);
+    sessions = calloc(sessionCount, sizeof(struct Session));
+    pollfds = calloc(sessionCount, sizeof(struct pollfd));
+
+    startedAt = getMonotonicMicroseconds();
+    for (int i = 0; i < sessionCount; i++) {
+        (sessions + i)->remaining = commandCount;
+        if (startSession(sessions + i, path, isPty) == -1) {
+            perror("startSession()");
+            return 1;
+        }
+        active++;
+    }
+
+    while (active > 0) {
+        for (int i = 0; i < sessionCount; i++) {
+            (pollfds + i)->fd = (sessions + i)->outFd;
+            (pollfds + i)->events = POLLIN;
+        }
+        if (poll(pollfds, sessionCount, 1000) == -1 && errno != EINTR) {
+            perror("poll()");
+            break;
+        }
+        now = getMonotonicMicroseconds();
+        for (int i = 0; i < sessionCount; i++) {
+            struct Session *session = sessions + i;
+            int prompts = 0;
+
+            if (session->outFd == -1) {
+                continue;
+            }
+            if ((pollfds + i)->revents) {
+                prompts = readSession(session);
+            }
+            if (prompts == -1 || (session->isWaiting && now - session->sentAt > timeout)) {
+                if (session->remaining > 0 || session->isWaiting) {
+                    errors++;
+                }
+                close(session->outFd);
+                close(session->inFd);
+                kill(session->pid, SIGKILL);
+                waitpid(session->pid, NULL, 0);
+                session->outFd = -1;
+                active--;
+                continue;
+            }
+            if (prompts == 0) {
+                continue;
+            }
+            if (session->isWaiting && session->isStarted) {
+                recordHistogram(&histogram, getMonotonicMicroseconds() - session->sentAt);
+            }
+            session->isWaiting = 0;
+            session->isStarted = 1;
+            if (session->remaining > 0) {
+                session->remaining--;
+                session->isWaiting = 1;
+                session->sentAt = getMonotonicMicroseconds();
+                sendSession(session, pickMixLine(mix, mixCount, totalWeight));
+            } else if (session->remaining == 0) {
+                session->remaining = -1;
+                sendSession(session, "exit");
+            }
+        }
+    }
+    elapsed = getMonotonicMicroseconds() - startedAt;
+
+    printf("sessions      %d\n", sessionCount);
+    printf("commands      %ld\n", histogram.total);
+    printf("errors        %d\n", errors);
+    printf("elapsed       %.3f s\n", elapsed / 1e6);
+    printf("throughput    %.1f commands/s\n", histogram.total / (elapsed / 1e6));
+    if (histogram.total > 0) {
+        printf("latency mean  %.1f us\n", histogram.sum / histogram.total);
+        printf("latency min   %ld us\n", histogram.min);
+        printf("latency p50   %ld us\n", getHistogramPercentile(&histogram, 50));
+        printf("latency p99   %ld us\n", getHistogramPercentile(&histogram, 99));
+        printf("latency p999  %ld us\n", getHistogramPercentile(&histogram, 99.9));
+        printf("latency max   %ld us\n", histogram.max);
+        printf("\n");
+        printHistogram(&histogram);
+    }
+
+    free(histogram.counts);
+    free(sessions);
+    free(pollfds);
+
+    return errors ? 1 : 0;
+}
+
+/*
+ * Get the time of a monotonic clock in microseconds.
+ */
+long getMonotonicMicroseconds(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+/*
+ * Print the command line options.
+ */
+void printUsage(char *name) {
+    fprintf(stderr, "usage: %s [-n sessions] [-c commands] [-m mix | -f file] [-t seconds] [-p] [smallsh]\n", name);
+    fprintf(stderr, "  -n  concurrent sessions (default 16)\n");
+    fprintf(stderr, "  -c  commands per session (default 200)\n");
+    fprintf(stderr, "  -m  weights of builtin, fg, bg and redir commands\n");
+    fprintf(stderr, "      (default builtin=40,fg=40,bg=10,redir=10)\n");
+    fprintf(stderr, "  -f  file of \"weight command line\" entries instead of -m\n");
+    fprintf(stderr, "  -t  seconds before a command, or the first prompt, counts as hung (default 10)\n");
+    fprintf(stderr, "  -p  run sessions on ptys instead of pipes\n");
+}
+
+/*
+ * Parse a comma-separated list of kind=weight pairs into mix.
+ *
+ * The kinds are builtin (status), fg (a foreground exec), bg (a background
+ * job) and redir (a command with stdin and stdout redirection).
+ *
+ * Return the number of entries, or 0 if the list is malformed.
+ */
+int parseMix(char *spec, struct Mix *mix, int size) {
+    char *kinds[4] = {"builtin", "fg", "bg", "redir"};
+    char *lines[4] = {"status", "echo loadgen", "true &", "cat < /etc/hostname > /dev/null"};
+    char *copy = malloc(sizeof(char) * (strlen(spec) + 1));
+    char *token;
+    char *state = NULL;
+    char *weight;
+    int count = 0;
+    int isKnown = 0;
+
+    strcpy(copy, spec);
+    for (token = strtok_r(copy, ",", &state); token != NULL; token = strtok_r(NULL, ",", &state)) {
+        weight = strchr(token, '=');
+        if (weight == NULL || count == size) {
+            free(copy);
+            return 0;
+        }
+        *weight = '\0';
+        isKnown = 0;
+        for (int i = 0; i < 4; i++) {
+            if (strcmp(token, *(kinds + i)) == 0) {
+                (mix + count)->weight = atoi(weight + 1);
+                (mix + count)->line = *(lines + i);
+                isKnown = 1;
+                count++;
+                break;
+            }
+        }
+        if (!isKnown) {
+            fprintf(stderr, "unknown command kind %s\n", token);
+            free(copy);
+            return 0;
+        }
+    }
+
+    free(copy);
+    return count;
+}
+
+/*
+ * Read a mix from a file with one "weight command line" entry per line.
+ *
+ * Blank lines and lines starting with an octothorpe are skipped. The lines
+ * are kept for the lifetime of the program.
+ *
+ * Return the number of entries, or 0 if the file cannot be read.
+ */
+int readMixFile(char *filename, struct Mix *mix, int size) {
+    FILE *fp = fopen(filename, "r");
+    char buffer[4096];
+    char *line;
+    int count = 0;
+    int weight = 0;
+    int offset = 0;
+
+    if (fp == NULL) {
+        perror(filename);
+        return 0;
+    }
+
+    while (count < size && fgets(buffer, sizeof(buffer), fp) != NULL) {
+        buffer[strcspn(buffer, "\n")] = '\0';
+        if (sscanf(buffer, "%d %n", &weight, &offset) != 1 || buffer[offset] == '\0') {
+            continue;
+        }
+        line = malloc(sizeof(char) * (strlen(buffer + offset) + 1));
+        strcpy(line, buffer + offset);
+        (mix + count)->weight = weight;
+        (mix + count)->line = line;
+        count++;
+    }
+
+    fclose(fp);
+    return count;
+}
+
+/*
+ * Pick a command line from the mix with probability proportional to weight.
+ */
+char *pickMixLine(struct Mix *mix, int count, int totalWeight) {
+    int pick = rand() % totalWeight;
+    for (int i = 0; i < count; i++) {
+        pick -= (mix + i)->weight;
+        if (pick < 0) {
+            return (mix + i)->line;
+        }
+    }
+    return (mix + count - 1)->line;
+}
+
+/*
+ * Start a smallsh process on a pair of pipes or a pty.
+ *
+ * The pty is put in raw mode, so input is not echoed back and output is not
+ * translated, which keeps prompt detection identical for both transports.
+ * The stderr of smallsh is discarded. The session waits for its first
+ * prompt from the moment it starts, so a shell that never prompts times out
+ * like a hung command, but that wait is not recorded as a latency.
+ *
+ * Return 0 on success, or -1 with errno set.
+ */
+int startSession(struct Session *session, char *path, int isPty) {
+    int inPipe[2] = {-1, -1};
+    int outPipe[2] = {-1, -1};
+    int master = -1;
+    int slave = -1;
+    int devNull = open("/dev/null", O_WRONLY | O_CLOEXEC);
+    struct termios attributes;
+    pid_t pid;
+
+    if (isPty) {
+        master = posix_openpt(O_RDWR | O_NOCTTY | O_CLOEXEC);
+        if (master == -1 || grantpt(master) == -1 || unlockpt(master) == -1) {
+            return -1;
+        }
+        slave = open(ptsname(master), O_RDWR | O_NOCTTY | O_CLOEXEC);
+        if (slave == -1) {
+            return -1;
+        }
+        tcgetattr(slave, &attributes);
+        cfmakeraw(&attributes);
+        tcsetattr(slave, TCSANOW, &attributes);
+        inPipe[0] = slave;
+        outPipe[1] = slave;
+    } else if (pipe2(inPipe, O_CLOEXEC) == -1 || pipe2(outPipe, O_CLOEXEC) == -1) {
+        return -1;
+    }
+
+    pid = fork();
+    switch (pid) {
+        case -1:
+            return -1;
+        case 0:
+            if (isPty) {
+                setsid();
+            }
+            dup2(inPipe[0], STDIN_FILENO);
+            dup2(outPipe[1], STDOUT_FILENO);
+            dup2(devNull, STDERR_FILENO);
+            execl(path, path, (char*) NULL);
+            _exit(127);
+        default:
+            break;
+    }
+
+    close(devNull);
+    session->pid = pid;
+    session->isWaiting = 1;
+    session->isStarted = 0;
+    session->sentAt = getMonotonicMicroseconds();
+    session->isAtLineStart = 1;
+    session->isColon = 0;
+    if (isPty) {
+        close(slave);
+        session->inFd = master;
+        session->outFd = master;
+    } else {
+        close(inPipe[0]);
+        close(outPipe[1]);
+        session->inFd = inPipe[1];
+        session->outFd = outPipe[0];
+    }
+    fcntl(session->outFd, F_SETFL, O_NONBLOCK);
+
+    return 0;
+}
+
+/*
+ * Read the available output of a session and count the prompts in it.
+ *
+ * A prompt is ": " at the start of a line or right after another prompt.
+ *
+ * Return the number of prompts, or -1 once the session has closed.
+ */
+int readSession(struct Session *session) {
+    char buffer[4096];
+    int prompts = 0;
+    ssize_t size = 0;
+    char ch = '\0';
+
+    while ((size = read(session->outFd, buffer, sizeof(buffer))) > 0) {
+        for (ssize_t i = 0; i < size; i++) {
+            ch = buffer[i];
+            if (session->isColon) {
+                session->isColon = 0;
+                if (ch == ' ') {
+                    prompts++;
+                    session->isAtLineStart = 1;
+                    continue;
+                }
+            } else if (session->isAtLineStart && ch == ':') {
+                session->isColon = 1;
+                continue;
+            }
+            session->isAtLineStart = ch == '\n';
+        }
+    }
+
+    if (size == 0 || (size == -1 && errno != EAGAIN && errno != EINTR)) {
+        return prompts ? prompts : -1;
+    }
+    return prompts;
+}
+
+/*
+ * Send one command line to a session.
+ */
+void sendSession(struct Session *session, char *line) {
+    int length = strlen(line);
+    char buffer[length + 1];
+
+    memcpy(buffer, line, length);
+    buffer[length] = '\n';
+    if (write(session->inFd, buffer, length + 1) != length + 1) {
+        perror("write()");
+    }
+}
+
+/*
+ * Initialize an empty histogram.
+ */
+void initHistogram(struct Histogram *histogram) {
+    histogram->counts = calloc((BUCKET_COUNT + 1) << SUB_BUCKET_BITS, sizeof(long));
+    histogram->total = 0;
+    histogram->min = 0;
+    histogram->max = 0;
+    histogram->sum = 0;
+}
+
+/*
+ * Get the bucket index of a value.
+ *
+ * Values below 2048 have an exact bucket. Above that, each power of two is
+ * split into 1024 equal sub-buckets, so the relative error stays below 0.1%.
+ */
+int getHistogramIndex(long value) {
+    int shift = 0;
+    if (value < 0) {
+        value = 0;
+    }
+    if (value < (2 << SUB_BUCKET_BITS)) {
+        return value;
+    }
+    shift = 63 - __builtin_clzl(value) - SUB_BUCKET_BITS;
+    return (shift << SUB_BUCKET_BITS) + (value >> shift);
+}
+
+/*
+ * Get the highest value that falls in the bucket with the given index.
+ */
+long getHistogramValue(int index) {
+    int shift = 0;
+    if (index < (2 << SUB_BUCKET_BITS)) {
+        return index;
+    }
+    shift = (index >> SUB_BUCKET_BITS) - 1;
+    return (((long) index - ((long) shift << SUB_BUCKET_BITS)) << shift) + (1L << shift) - 1;
+}
+
+/*
+ * Record one value in the histogram.
+ */
+void recordHistogram(struct Histogram *histogram, long value) {
+    *(histogram->counts + getHistogramIndex(value)) += 1;
+    if (histogram->total == 0 || value < histogram->min) {
+        histogram->min = value;
+    }
+    if (value > histogram->max) {
+        histogram->max = value;
+    }
+    histogram->total++;
+    histogram->sum += value;
+}
+
+/*
+ * Get the value below which the given percentage of recorded values fall.
+ */
+long getHistogramPercentile(struct Histogram *histogram, double percentile) {
+    long target = (long) (percentile / 100 * histogram->total + 0.5);
+    long count = 0;
+    int size = (BUCKET_COUNT + 1) << SUB_BUCKET_BITS;
+
+    if (target < 1) {
+        target = 1;
+    }
+    for (int i = 0; i < size; i++) {
+        count += *(histogram->counts + i);
+        if (count >= target) {
+            return getHistogramValue(i) < histogram->max ? getHistogramValue(i) : histogram->max;
+        }
+    }
+    return histogram->max;
+}
+
+/*
+ * Print the percentile distribution in the HdrHistogram text format.
+ *
+ * Every halving of the distance to 100% is reported in five steps, so the
+ * tail is shown in as much detail as the median.
+ */
+void printHistogram(struct Histogram *histogram) {
+    double percentile = 0;
+    double step = 0;
+    long value = 0;
+    long count = 0;
+    int size = (BUCKET_COUNT + 1) << SUB_BUCKET_BITS;
+
+    printf("%12s %14s %10s %14s\n\n", "Value(us)", "Percentile", "TotalCount", "1/(1-Percentile)");
+    for (int half = 0; half < 40 && count < histogram->total; half++) {
+        step = 1.0 / (1L << (half + 1)) / 5;
+        for (int tick = 0; tick < 5; tick++) {
+            percentile = 1 - 1.0 / (1L << half) + tick * step;
+            value = getHistogramPercentile(histogram, percentile * 100);
+            count = 0;
+            for (int i = 0; i < size && getHistogramValue(i) <= value; i++) {
+                count += *(histogram->counts + i);
+            }
+            if (count >= histogram->total) {
+                break;
+            }
+            printf("%12ld %14.12f %10ld %14.2f\n", value, percentile, count, 1 / (1 - percentile));
+        }
+    }
+    printf("%12ld %14.12f %10ld\n", histogram->max, 1.0, histogram->total);
+    printf("#[Mean    = %12.3f, StdDeviation   = n/a]\n", histogram->sum / histogram->total);
+    printf("#[Max     = %12ld, Total count    = %12ld]\n", histogram->max, histogram->total);
+    printf("#[Buckets = %12d, SubBuckets     = %12d]\n", BUCKET_COUNT, 2 << SUB_BUCKET_BITS);
+}
@@ -0,0 +1,279 @@
+#include "environment.h"
+#include "lookahead.h"
+#include "util.h"
+
+/*
+ * Create the lookahead queue for the script read from fd.
+ *
+ * The queue holds $SMALLSH_LOOKAHEAD lines, LOOKAHEAD_CAPACITY by default.
+ * If fd is not a regular file, e.g. a terminal or a pipe, or the capacity is
+ * 0, the queue stays empty and every line is read directly.
+ */
+struct Lookahead *openLookahead(int fd) {
+    MEMSTATS_SCOPE(MEMSTATS_PARSER);
+    struct Lookahead *lookahead = malloc(sizeof(struct Lookahead));
+    char *value = getenv("SMALLSH_LOOKAHEAD");
+    struct stat info;
+    int capacity = value != NULL ? atoi(value) : LOOKAHEAD_CAPACITY;
+
+    if (capacity < 0 || fstat(fd, &info) == -1 || !S_ISREG(info.st_mode)) {
+        capacity = 0;
+    }
+
+    lookahead->lines = malloc(sizeof(char*) * (capacity + 1));
+    lookahead->capacity = malloc(sizeof(int));
+    lookahead->count = malloc(sizeof(int));
+    lookahead->head = malloc(sizeof(int));
+    lookahead->prefetched = malloc(sizeof(int));
+    lookahead->isBlocked = malloc(sizeof(int));
+    *(lookahead->capacity) = capacity;
+    *(lookahead->count) = 0;
+    *(lookahead->head) = 0;
+    *(lookahead->prefetched) = 0;
+    *(lookahead->isBlocked) = 0;
+
+    return lookahead;
+}
+
+/*
+ * Free all memory in a lookahead struct, including lines not yet run.
+ */
+void freeLookahead(struct Lookahead *lookahead) {
+    for (int i = 0; i < *(lookahead->count); i++) {
+        free(*(lookahead->lines + (*(lookahead->head) + i) % *(lookahead->capacity)));
+    }
+    free(lookahead->lines);
+    free(lookahead->capacity);
+    free(lookahead->count);
+    free(lookahead->head);
+    free(lookahead->prefetched);
+    free(lookahead->isBlocked);
+    free(lookahead);
+}
+
+/*
+ * Prompt for the next line, taking it from the queue if one was read ahead.
+ *
+ * Otherwise, fall back to getUserInput(). Once the queue is drained, reading
+ * ahead may continue past the barrier that stopped it.
+ */
+void readLookaheadInput(struct Lookahead *lookahead, char *prompt, char *buffer, int size) {
+    char *line;
+
+    if (*(lookahead->count) == 0) {
+        getUserInput(prompt, buffer, size);
+        return;
+    }
+
+    printf("%s", prompt);
+    fflush(stdout);
+
+    line = takeLookaheadLine(lookahead);
+    snprintf(buffer, size, "%s", line);
+    free(line);
+}
+
+/*
+ * Take the oldest line from the queue, for a reader of stdin that must see
+ * the lines read ahead before the rest of stdin.
+ *
+ * Return the dynamically allocated line, or NULL if the queue is empty.
+ */
+char *takeLookaheadLine(struct Lookahead *lookahead) {
+    char *line;
+
+    if (*(lookahead->count) == 0) {
+        return NULL;
+    }
+
+    line = *(lookahead->lines + *(lookahead->head));
+    *(lookahead->head) = (*(lookahead->head) + 1) % *(lookahead->capacity);
+    *(lookahead->count) -= 1;
+    if (*(lookahead->prefetched) > 0) {
+        *(lookahead->prefetched) -= 1;
+    }
+    if (*(lookahead->count) == 0) {
+        *(lookahead->isBlocked) = 0;
+    }
+
+    return line;
+}
+
+/*
+ * Fill the queue from stdin, then prefetch every queued line that has not
+ * been prefetched yet.
+ *
+ * This is called while a foreground command runs, so that the reads it
+ * starts overlap the command.
+ */
+void prefetchLookahead(struct Lookahead *lookahead) {
+    MEMSTATS_SCOPE(MEMSTATS_PARSER);
+    size_t length = 0;
+    char *buffer = NULL;
+    char *line;
+    int capacity = *(lookahead->capacity);
+
+    while (*(lookahead->count) < capacity && !*(lookahead->isBlocked)) {
+        if (getline(&buffer, &length, stdin) == -1) {
+            break;
+        }
+        *(buffer + strcspn(buffer, "\n")) = '\0';
+        line = malloc(sizeof(char) * (stringLength(buffer) + 1));
+        copyString(buffer, line);
+        *(lookahead->lines + (*(lookahead->head) + *(lookahead->count)) % capacity) = line;
+        *(lookahead->count) += 1;
+        if (isLookaheadBarrier(line)) {
+            *(lookahead->isBlocked) = 1;
+        }
+    }
+
+    for (; *(lookahead->prefetched) < *(lookahead->count); *(lookahead->prefetched) += 1) {
+        line = *(lookahead->lines + (*(lookahead->head) + *(lookahead->prefetched)) % capacity);
+        if (!isLookaheadBarrier(line)) {
+            prefetchLine(line);
+        }
+    }
+    memstatsFreeUntracked(buffer);
+}
+
+/*
+ * Check whether a line depends on the effects of the lines before it, or is
+ * followed by a here-document body rather than by commands.
+ *
+ * If it does, return 1. Otherwise, return 0.
+ */
+int isLookaheadBarrier(char *line) {
+    int length = 0;
+    char first[64];
+
+    while (*line == ' ') {
+        line++;
+    }
+    length = strcspn(line, " ");
+    if (length >= sizeof(first)) {
+        length = sizeof(first) - 1;
+    }
+    memcpy(first, line, length);
+    *(first + length) = '\0';
+
+    if (isEqualString(first, "cd") || isEqualString(first, "export") || isEqualString(first, "unset")) {
+        return 1;
+    }
+    return isAssignment(first) || strstr(line, "<<") != NULL;
+}
+
+/*
+ * Prefetch the executable, the < files and the directories of the > files of
+ * a line. Words that still need expansion are skipped.
+ */
+void prefetchLine(char *line) {
+    char *copy = malloc(sizeof(char) * (stringLength(line) + 1));
+    char *word;
+    char *saveptr;
+    char *path;
+    int isFirst = 1;
+
+    copyString(line, copy);
+    for (word = strtok_r(copy, " ", &saveptr); word != NULL; word = strtok_r(NULL, " ", &saveptr)) {
+        if (isFirst && *word == '#') {
+            break;
+        }
+        if (isFirst && strchr(word, '$') == NULL) {
+            path = resolveExecutable(word);
+            if (path != NULL) {
+                prefetchFile(path);
+                free(path);
+            }
+        } else if (isEqualString(word, "<") || isEqualString(word, ">")) {
+            path = strtok_r(NULL, " ", &saveptr);
+            if (path != NULL && strchr(path, '$') == NULL) {
+                if (*word == '<') {
+                    prefetchFile(path);
+                } else {
+                    prefetchDirectory(path);
+                }
+            }
+        }
+        isFirst = 0;
+    }
+    free(copy);
+}
+
+/*
+ * Find the file that execvp() would run for name, searching PATH if name
+ * has no slash.
+ *
+ * Return the dynamically allocated path, or NULL if there is none.
+ */
+char *resolveExecutable(char *name) {
+    char *value = getenv("PATH");
+    char *directory;
+    char *saveptr;
+    char *path;
+    char *copy;
+
+    if (strchr(name, '/') != NULL) {
+        path = malloc(sizeof(char) * (stringLength(name) + 1));
+        copyString(name, path);
+        return path;
+    }
+    if (value == NULL) {
+        return NULL;
+    }
+
+    copy = malloc(sizeof(char) * (stringLength(value) + 1));
+    copyString(value, copy);
+    for (directory = strtok_r(copy, ":", &saveptr); directory != NULL; directory = strtok_r(NULL, ":", &saveptr)) {
+        path = joinPath(directory, name);
+        if (access(path, X_OK) == 0) {
+            free(copy);
+            return path;
+        }
+        free(path);
+    }
+    free(copy);
+
+    return NULL;
+}
+
+/*
+ * Ask the kernel to start reading the head of a regular file into the page
+ * cache. Only the head is requested, as a command that reads on will
+ * trigger the kernel's own readahead, and one that only stats the file
+ * should not pay for reading all of it.
+ *
+ * The file is opened without blocking, so a FIFO is skipped rather than
+ * waited on.
+ */
+void prefetchFile(char *path) {
+    struct stat info;
+    int fd = open(path, O_RDONLY | O_NONBLOCK | O_NOCTTY | O_CLOEXEC);
+
+    if (fd == -1) {
+        return;
+    }
+    if (fstat(fd, &info) == 0 && S_ISREG(info.st_mode)) {
+        posix_fadvise(fd, 0, LOOKAHEAD_PREFETCH_BYTES, POSIX_FADV_WILLNEED);
+    }
+    close(fd);
+}
+
+/*
+ * Look up the directory that will hold an output file, so that its entry
+ * and inode are cached by the time the file is created.
+ */
+void prefetchDirectory(char *path) {
+    struct stat info;
+    char *slash = strrchr(path, '/');
+    char *directory;
+
+    if (slash == NULL) {
+        stat(".", &info);
+        return;
+    }
+    directory = malloc(sizeof(char) * (slash - path + 2));
+    memcpy(directory, path, slash - path + (slash == path));
+    *(directory + (slash - path) + (slash == path)) = '\0';
+    stat(directory, &info);
+    free(directory);
+}
@@ -0,0 +1,70 @@
+#ifndef LOOKAHEAD_H
+#define LOOKAHEAD_H
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "memstats.h"
+
+/*
+ * The lookahead file prefetches the next lines of a script while the
+ * current foreground command runs.
+ *
+ * When stdin is a regular file, up to capacity lines are read ahead into a
+ * queue, and the shell takes its next line from the queue before reading
+ * stdin again. For each queued line, the executable is resolved through PATH
+ * and, like every < file, has its first LOOKAHEAD_PREFETCH_BYTES handed to
+ * posix_fadvise(POSIX_FADV_WILLNEED), and the directory of every > file is
+ * stat()ed, so that the disk reads overlap the running command instead of
+ * stacking up between commands.
+ *
+ * Prefetching is advisory, and never changes what a line does. Reading
+ * ahead stops at a line whose meaning depends on the effects of the lines
+ * before it, such as cd, export, unset or an assignment, and at a line with
+ * a here-document, whose body must still be read from stdin.
+ */
+
+enum LookaheadSize {
+    LOOKAHEAD_CAPACITY = 8,
+    LOOKAHEAD_PREFETCH_BYTES = 512 * 1024
+};
+
+struct Lookahead {
+    char **lines;
+    int *capacity;
+    int *count;
+    int *head;
+    int *prefetched;
+    int *isBlocked;
+};
+
+struct Lookahead *openLookahead(int fd);
+
+void freeLookahead(struct Lookahead *lookahead);
+
+void readLookaheadInput(struct Lookahead *lookahead, char *prompt, char *buffer, int size);
+
+char *takeLookaheadLine(struct Lookahead *lookahead);
+
+void prefetchLookahead(struct Lookahead *lookahead);
+
+int isLookaheadBarrier(char *line);
+
+void prefetchLine(char *line);
+
+char *resolveExecutable(char *name);
+
+void prefetchFile(char *path);
+
+void prefetchDirectory(char *path);
+
+#endif
@@ -0,0 +1,205 @@
+#define MEMSTATS_IMPLEMENTATION
+
+#include <string.h>
+
+#include "memstats.h"
+
+/*
+ * Every tracked block is preceded by a header that records its size and tag,
+ * so that realloc and free can charge the right counters. The header is 16
+ * bytes to keep the block aligned for any type.
+ */
+
+struct MemstatsHeader {
+    size_t size;
+    unsigned int tag;
+    unsigned int magic;
+};
+
+struct MemstatsCounter {
+    long mallocCalls;
+    long reallocCalls;
+    long freeCalls;
+    long liveBlocks;
+    long liveBytes;
+    long peakBytes;
+};
+
+static struct MemstatsCounter g_memstatsCounters[MEMSTATS_TAG_COUNT];
+
+static long g_memstatsLiveBytes = 0;
+
+static long g_memstatsPeakBytes = 0;
+
+static int g_memstatsTag = MEMSTATS_SHELL;
+
+static const unsigned int MEMSTATS_MAGIC = 0x6d656d73;
+
+/*
+ * Check if smallsh was built with the counting allocator.
+ */
+int isMemstatsEnabled(void) {
+#ifdef SMALLSH_MEMSTATS
+    return 1;
+#else
+    return 0;
+#endif
+}
+
+/*
+ * Print the counters of every tag, followed by the totals.
+ */
+void printMemstats(FILE *stream) {
+    char *names[MEMSTATS_TAG_COUNT] = {"shell", "parser", "expansion", "jobs", "environment"};
+    struct MemstatsCounter total = {0};
+    struct MemstatsCounter *counter;
+
+    fprintf(stream, "%-12s %10s %10s %10s %10s %12s %12s\n",\
+    "tag", "malloc", "realloc", "free", "blocks", "live bytes", "peak bytes");
+    for (int i = 0; i < MEMSTATS_TAG_COUNT; i++) {
+        counter = g_memstatsCounters + i;
+        fprintf(stream, "%-12s %10ld %10ld %10ld %10ld %12ld %12ld\n", *(names + i),\
+        counter->mallocCalls, counter->reallocCalls, counter->freeCalls,\
+        counter->liveBlocks, counter->liveBytes, counter->peakBytes);
+        total.mallocCalls += counter->mallocCalls;
+        total.reallocCalls += counter->reallocCalls;
+        total.freeCalls += counter->freeCalls;
+        total.liveBlocks += counter->liveBlocks;
+    }
+    fprintf(stream, "%-12s %10ld %10ld %10ld %10ld %12ld %12ld\n", "total",\
+    total.mallocCalls, total.reallocCalls, total.freeCalls,\
+    total.liveBlocks, g_memstatsLiveBytes, g_memstatsPeakBytes);
+}
+
+/*
+ * Make tag the current tag and return the previous one.
+ */
+int swapMemstatsTag(int tag) {
+    int previous = g_memstatsTag;
+    g_memstatsTag = tag;
+    return previous;
+}
+
+/*
+ * Restore the tag saved by MEMSTATS_SCOPE when its scope ends.
+ */
+void restoreMemstatsTag(int *tag) {
+    g_memstatsTag = *tag;
+}
+
+/*
+ * Charge size bytes to, or with a negative size refund them from, a tag.
+ */
+static void chargeMemstats(unsigned int tag, long size, int blocks) {
+    struct MemstatsCounter *counter = g_memstatsCounters + tag;
+
+    counter->liveBytes += size;
+    counter->liveBlocks += blocks;
+    if (counter->liveBytes > counter->peakBytes) {
+        counter->peakBytes = counter->liveBytes;
+    }
+
+    g_memstatsLiveBytes += size;
+    if (g_memstatsLiveBytes > g_memstatsPeakBytes) {
+        g_memstatsPeakBytes = g_memstatsLiveBytes;
+    }
+}
+
+/*
+ * Allocate a block charged to the current tag.
+ */
+void *memstatsMalloc(size_t size) {
+    struct MemstatsHeader *header = malloc(sizeof(struct MemstatsHeader) + size);
+
+    if (header == NULL) {
+        return NULL;
+    }
+
+    header->size = size;
+    header->tag = g_memstatsTag;
+    header->magic = MEMSTATS_MAGIC;
+    (g_memstatsCounters + header->tag)->mallocCalls++;
+    chargeMemstats(header->tag, size, 1);
+
+    return header + 1;
+}
+
+/*
+ * Allocate a zeroed block charged to the current tag.
+ */
+void *memstatsCalloc(size_t count, size_t size) {
+    void *ptr = NULL;
+
+    if (size != 0 && count > (size_t) -1 / size) {
+        return NULL;
+    }
+
+    ptr = memstatsMalloc(count * size);
+    if (ptr != NULL) {
+        memset(ptr, 0, count * size);
+    }
+    return ptr;
+}
+
+/*
+ * Find the header of a block, and abort if the block was not allocated by the
+ * wrappers, as its header would then be memory that the C library owns.
+ */
+static struct MemstatsHeader *findMemstatsHeader(void *ptr, char *caller) {
+    struct MemstatsHeader *header = (struct MemstatsHeader*) ptr - 1;
+
+    if (header->magic != MEMSTATS_MAGIC) {
+        fprintf(stderr, "memstats: %s of a block that memstats did not allocate\n", caller);
+        abort();
+    }
+    return header;
+}
+
+/*
+ * Resize a block, keeping the tag it was first allocated under.
+ */
+void *memstatsRealloc(void *ptr, size_t size) {
+    struct MemstatsHeader *header;
+    size_t previous = 0;
+
+    if (ptr == NULL) {
+        return memstatsMalloc(size);
+    }
+
+    header = findMemstatsHeader(ptr, "realloc");
+    previous = header->size;
+    header = realloc(header, sizeof(struct MemstatsHeader) + size);
+    if (header == NULL) {
+        return NULL;
+    }
+
+    header->size = size;
+    (g_memstatsCounters + header->tag)->reallocCalls++;
+    chargeMemstats(header->tag, (long) size - (long) previous, 0);
+
+    return header + 1;
+}
+
+/*
+ * Free a block and refund its tag.
+ */
+void memstatsFree(void *ptr) {
+    struct MemstatsHeader *header;
+
+    if (ptr == NULL) {
+        return;
+    }
+
+    header = findMemstatsHeader(ptr, "free");
+    header->magic = 0;
+    (g_memstatsCounters + header->tag)->freeCalls++;
+    chargeMemstats(header->tag, -(long) header->size, -1);
+    free(header);
+}
+
+/*
+ * Free a buffer that the C library allocated itself, which has no header.
+ */
+void memstatsFreeUntracked(void *ptr) {
+    free(ptr);
+}
\ No newline at end of file
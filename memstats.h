@@ -0,0 +1,60 @@
+#ifndef MEMSTATS_H
+#define MEMSTATS_H
+
+#include <stdio.h>
+#include <stdlib.h>
+
+/*
+ * The memstats file contains an optional counting allocator for smallsh.
+ *
+ * When smallsh is built with SMALLSH_MEMSTATS defined (make MEMSTATS=1),
+ * malloc, calloc, realloc and free are redirected through counting wrappers.
+ * Each allocation is charged to the tag that is current when it is made, and
+ * a function changes the current tag for its own duration with
+ * MEMSTATS_SCOPE(tag). Without the switch, the macros compile to nothing.
+ *
+ * Every block passed to realloc or free must come from the wrappers. A buffer
+ * that the C library allocates itself, such as the line of getline(), must
+ * be released with memstatsFreeUntracked() instead.
+ *
+ * This header must be included after stdlib.h.
+ */
+
+enum MemstatsTag {
+    MEMSTATS_SHELL,
+    MEMSTATS_PARSER,
+    MEMSTATS_EXPANSION,
+    MEMSTATS_JOBS,
+    MEMSTATS_ENVIRONMENT,
+    MEMSTATS_TAG_COUNT
+};
+
+int isMemstatsEnabled(void);
+
+void printMemstats(FILE *stream);
+
+int swapMemstatsTag(int tag);
+
+void restoreMemstatsTag(int *tag);
+
+void *memstatsMalloc(size_t size);
+
+void *memstatsCalloc(size_t count, size_t size);
+
+void *memstatsRealloc(void *ptr, size_t size);
+
+void memstatsFree(void *ptr);
+
+void memstatsFreeUntracked(void *ptr);
+
+#if defined(SMALLSH_MEMSTATS) && !defined(MEMSTATS_IMPLEMENTATION)
+#define malloc(size) memstatsMalloc(size)
+#define calloc(count, size) memstatsCalloc(count, size)
+#define realloc(ptr, size) memstatsRealloc(ptr, size)
+#define free(ptr) memstatsFree(ptr)
+#define MEMSTATS_SCOPE(tag) int memstatsSavedTag __attribute__((cleanup(restoreMemstatsTag), unused)) = swapMemstatsTag(tag)
+#else
+#define MEMSTATS_SCOPE(tag)
+#endif
+
+#endif
\ No newline at end of file
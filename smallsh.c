@@ -1,6 +1,8 @@
 #include "smallsh.h"
 #include "util.h"
 
+static volatile sig_atomic_t g_isInterrupted = 0;
+
 /*
  * Run the shell.
  *
@@ -23,10 +25,11 @@ void runShell(void) {
     while (*(shell->isRunning)) {
         command = malloc(sizeof(struct Command));
         initCommand(command);
-        getUserInput(prompt, buffer, MAX_LENGTH);
+        readLookaheadInput(shell->lookahead, prompt, buffer, MAX_LENGTH);
         parseCommand(buffer, command, shell);
         if (command->wordc != NULL) {
             addNullToCommandVector(command);
+            readHereDocument(command, shell);
             setIsBuiltinCommand(command);
             setIsBackgroundCommand(command, shell);
             redirectStdin(command, shell);
@@ -48,6 +51,7 @@ void runShell(void) {
         if (*(shell->isRunningBackgroundProcess)) {
             checkBackgroundPids(shell);
         }
+        setBoardStatus(shell->board, *(shell->status), *(shell->isTimedOut));
         freeCommand(command);
     }
     freeShell(shell);
@@ -64,25 +68,39 @@ void initShell(struct Shell *shell, int MAX_LENGTH) {
     shell->backgroundPids = malloc(sizeof(int*));
     shell->backgroundPidCount = malloc(sizeof(int));
     shell->MAX_LENGTH = malloc(sizeof(int));
+    shell->GRACE_PERIOD = malloc(sizeof(int));
     shell->STDIN_FD = malloc(sizeof(int));
     shell->STDOUT_FD = malloc(sizeof(int));
     shell->isRunning = malloc(sizeof(int));
     shell->isRunningBackgroundProcess = malloc(sizeof(int));
     shell->status = malloc(sizeof(int));
+    shell->isTimedOut = malloc(sizeof(int));
+    shell->timeout = malloc(sizeof(int));
+    shell->watchFd = malloc(sizeof(int));
     shell->pid = malloc(sizeof(int));
     shell->cwd = malloc(sizeof(char) * MAX_LENGTH);
     shell->HOME = malloc(sizeof(char) * MAX_LENGTH);
+    shell->environment = malloc(sizeof(struct Environment));
     *(shell->backgroundPidCount) = 0;
     *(shell->MAX_LENGTH) = MAX_LENGTH;
-    *(shell->STDIN_FD) = dup(STDIN_FILENO);
-    *(shell->STDOUT_FD) = dup(STDOUT_FILENO);
+    *(shell->GRACE_PERIOD) = 2000;
+    *(shell->STDIN_FD) = fcntl(STDIN_FILENO, F_DUPFD_CLOEXEC, 0);
+    *(shell->STDOUT_FD) = fcntl(STDOUT_FILENO, F_DUPFD_CLOEXEC, 0);
     *(shell->isRunning) = 1;
     *(shell->isRunningBackgroundProcess) = 0;
     *(shell->status) = 0;
+    *(shell->isTimedOut) = 0;
+    *(shell->timeout) = 0;
+    *(shell->watchFd) = -1;
     *(shell->pid) = getpid();
     shell->cwd = getcwd(shell->cwd, MAX_LENGTH);
     shell->devNull = "/dev/null";
     copyString(temp, shell->HOME);
+    initEnvironment(shell->environment, environ);
+    getEnvironmentVector(shell->environment);
+    shell->board = openBoard(*(shell->pid));
+    shell->cgroup = openCgroup(*(shell->pid));
+    shell->lookahead = openLookahead(STDIN_FILENO);
 }
 
 /*
@@ -95,54 +113,93 @@ void freeShell(struct Shell *shell) {
     free(shell->backgroundPids);
     free(shell->backgroundPidCount);
     free(shell->MAX_LENGTH);
+    free(shell->GRACE_PERIOD);
     free(shell->STDIN_FD);
     free(shell->STDOUT_FD);
     free(shell->isRunning);
     free(shell->isRunningBackgroundProcess);
     free(shell->status);
-    free(shell->pid);
+    free(shell->isTimedOut);
+    free(shell->timeout);
+    free(shell->watchFd);
     free(shell->cwd);
     free(shell->HOME);
+    freeEnvironment(shell->environment);
+    closeBoard(shell->board, *(shell->pid), getpid() == *(shell->pid));
+    closeCgroup(shell->cgroup, getpid() == *(shell->pid));
+    freeLookahead(shell->lookahead);
+    free(shell->pid);
     free(shell);
 }
 
 /*
+ * Reap the background jobs that have finished, and remove them from the
+ * table.
  *
+ * A job that is no longer a child of the shell can never be reaped, so it
+ * is removed without a status.
  */
 void checkBackgroundPids(struct Shell *shell) {
-    int temp[*(shell->backgroundPidCount)];
+    MEMSTATS_SCOPE(MEMSTATS_JOBS);
     int pid = 0;
     int status = 0;
-    int count = 0;
-    int index = 0;
-
-    count = *(shell->backgroundPidCount);
+    pid_t result = 0;
 
-    for (int i = 0; i < count; i++) {
-        pid = waitpid(*(*(shell->backgroundPids + i)), &status, WNOHANG);
-        if (pid) {
+    for (int i = 0; i < *(shell->backgroundPidCount); i++) {
+        pid = *(*(shell->backgroundPids + i));
+        result = waitpid(pid, &status, WNOHANG);
+        if (result == -1 && errno == ECHILD) {
+            removeBackgroundPid(shell, i);
+            i--;
+        } else if (result > 0) {
             *(shell->status) = status;
-            *(shell->backgroundPidCount) -= 1;
+            *(shell->isTimedOut) = 0;
             printf("background pid %d returned with exit value %d\n", pid, *(shell->status));
-            free(*(shell->backgroundPids + i));
-        } else {
-            temp[index] = *(*(shell->backgroundPids + i));
-            free(*(shell->backgroundPids + i));
-            index++;
+            removeBackgroundPid(shell, i);
+            i--;
         }
     }
+}
 
-    if (index) {
-        shell->backgroundPids = realloc(shell->backgroundPids, sizeof(int*) * index);
-        for (int i = 0; i < index; i++) {
-            *(shell->backgroundPids + i) = malloc(sizeof(int));
-            *(*(shell->backgroundPids + i)) = temp[i];
+/*
+ * Find the index of a background job in the table.
+ *
+ * If pid is not a background job, return -1.
+ */
+int findBackgroundPid(struct Shell *shell, pid_t pid) {
+    for (int i = 0; i < *(shell->backgroundPidCount); i++) {
+        if (*(*(shell->backgroundPids + i)) == pid) {
+            return i;
         }
-    } else {
-        shell->backgroundPids = realloc(shell->backgroundPids, sizeof(int*));
     }
+    return -1;
+}
+
+/*
+ * Remove the reaped background job at index from the table, keeping the
+ * remaining jobs in order, and release its board entry and cgroup leaf.
+ *
+ * An index outside the table, e.g. -1 from findBackgroundPid(), is ignored.
+ */
+void removeBackgroundPid(struct Shell *shell, int index) {
+    MEMSTATS_SCOPE(MEMSTATS_JOBS);
+    int count = *(shell->backgroundPidCount) - 1;
+    pid_t pid = 0;
+
+    if (index < 0 || index > count) {
+        return;
+    }
+    pid = *(*(shell->backgroundPids + index));
+    removeBoardJob(shell->board, pid);
+    removeCgroupJob(shell->cgroup, pid);
+    free(*(shell->backgroundPids + index));
+    for (int i = index; i < count; i++) {
+        *(shell->backgroundPids + i) = *(shell->backgroundPids + i + 1);
+    }
+    shell->backgroundPids = realloc(shell->backgroundPids, sizeof(int*) * (count ? count : 1));
+    *(shell->backgroundPidCount) = count;
 
-    if (*(shell->backgroundPidCount) == 0) {
+    if (count == 0) {
         *(shell->isRunningBackgroundProcess) = 0;
     }
 }
@@ -151,24 +208,99 @@ void checkBackgroundPids(struct Shell *shell) {
  * Redirect stdin to the specified stdout file in the command struct.
  */
 void redirectStdin(struct Command *command, struct Shell *shell) {
-    if (*(command->isStdinRedirection)) {
+    int fd = -1;
+
+    if (*(command->isHereDocument)) {
+        fd = createMemoryFile("smallsh-heredoc", command->hereDocument, stringLength(command->hereDocument));
+        if (fd != -1) {
+            command->stdinFile = fdopen(fd, "r");
+            dup2(fd, STDIN_FILENO);
+        } else {
+            perror("here-document failed");
+            *(command->isFailedRedirection) = 1;
+            *(shell->status) = 1;
+            *(shell->isTimedOut) = 0;
+        }
+    } else if (*(command->isStdinRedirection)) {
         if (*(command->stdinFileArg) <= *(command->wordc) &&\
         isValidFile(*(command->wordv + *(command->stdinFileArg)), "r")) {
-            command->stdinFile = fopen(*(command->wordv + *(command->stdinFileArg)), "r");
+            command->stdinFile = fopen(*(command->wordv + *(command->stdinFileArg)), "re");
             dup2(fileno(command->stdinFile), STDIN_FILENO);
         } else {
             perror("stdin redirection failed");
             *(command->isFailedRedirection) = 1;
             *(shell->status) = 1;
+            *(shell->isTimedOut) = 0;
         }
     } else {
         if (*(command->isBackground)) {
-            command->stdinFile = fopen(shell->devNull, "r");
+            command->stdinFile = fopen(shell->devNull, "re");
             dup2(fileno(command->stdinFile), STDIN_FILENO);
         }
     }
 }
 
+/*
+ * Get the body of a here-document or here-string.
+ *
+ * For <<WORD, read lines from the shell's input up to a line equal to WORD.
+ * For <<<string, the body is the string followed by a newline. The body has
+ * $$ expanded, and is stored in the command struct until redirectStdin()
+ * turns it into the stdin of the command.
+ */
+void readHereDocument(struct Command *command, struct Shell *shell) {
+    char *word;
+    char *line;
+    char *expanded;
+    int length = 0;
+    int lineLength = 0;
+
+    if (!*(command->isHereDocument) || *(command->stdinFileArg) >= *(command->wordc)) {
+        *(command->isHereDocument) = 0;
+        return;
+    }
+
+    word = *(command->wordv + *(command->stdinFileArg));
+    if (*(word) == '<' && *(word + 1) == '<') {
+        word += *(command->isHereDocument) + 1;
+    }
+
+    if (*(command->isHereDocument) == 2) {
+        command->hereDocument = malloc(sizeof(char) * (stringLength(word) + 2));
+        copyString(word, command->hereDocument);
+        *(command->hereDocument + stringLength(word)) = '\n';
+        *(command->hereDocument + stringLength(word) + 1) = '\0';
+        return;
+    }
+
+    line = malloc(sizeof(char) * *(shell->MAX_LENGTH));
+    command->hereDocument = malloc(sizeof(char));
+    *(command->hereDocument) = '\0';
+
+    while (1) {
+        *(line) = '\0';
+        getUserInput(isatty(STDIN_FILENO) ? "> " : "", line, *(shell->MAX_LENGTH));
+        if (feof(stdin) && *(line) == '\0') {
+            fprintf(stderr, "here-document delimited by end-of-file (wanted %s)\n", word);
+            break;
+        }
+        if (isEqualString(line, word)) {
+            break;
+        }
+        expanded = parseExpansion(line, shell);
+        lineLength = stringLength(expanded);
+        command->hereDocument = realloc(command->hereDocument, sizeof(char) * (length + lineLength + 2));
+        copyString(expanded, command->hereDocument + length);
+        length += lineLength;
+        *(command->hereDocument + length) = '\n';
+        length++;
+        *(command->hereDocument + length) = '\0';
+        free(expanded);
+    }
+
+    free(line);
+}
+
 /*
  * Redirect stdout to the specified stdout file in the command struct.
  */
@@ -176,32 +308,35 @@ void redirectStdout(struct Command *command, struct Shell *shell) {
     if (*(command->isStdoutRedirection)) {
         if (*(command->stdoutFileArg) <= *(command->wordc) &&\
         isValidFile(*(command->wordv + *(command->stdoutFileArg)), "w")) {
-            command->stdoutFile = fopen(*(command->wordv + *(command->stdoutFileArg)), "w");
+            command->stdoutFile = fopen(*(command->wordv + *(command->stdoutFileArg)), "we");
             dup2(fileno(command->stdoutFile), STDOUT_FILENO);
         } else {
             perror("stdout redirection failed");
             *(command->isFailedRedirection) = 1;
             *(shell->status) = 1;
+            *(shell->isTimedOut) = 0;
         }
     } else {
         if (*(command->isBackground)) {
-            command->stdoutFile = fopen(shell->devNull, "w");
+            command->stdoutFile = fopen(shell->devNull, "we");
             dup2(fileno(command->stdoutFile), STDOUT_FILENO);
         }
     }
 }
 
 /*
- *
+ * Close the files opened for redirection, including the /dev/null files of
+ * background commands and here-documents, so that the shell does not
+ * accumulate descriptors that every later child would inherit.
  */
 void closeFiles(struct Command *command) {
-    if (!*(command->isFailedRedirection)) {
-        if (*(command->stdinFileArg) != -1) {
-            fclose(command->stdinFile);
-        }
-        if (*(command->stdoutFileArg) != -1) {
-            fclose(command->stdoutFile);
-        }
+    if (command->stdinFile != NULL) {
+        fclose(command->stdinFile);
+        command->stdinFile = NULL;
+    }
+    if (command->stdoutFile != NULL) {
+        fclose(command->stdoutFile);
+        command->stdoutFile = NULL;
     }
 }
 
@@ -220,7 +355,7 @@ void resetOutput(struct Shell *shell) {
  * to 0.
  */
 void setIsBuiltinCommand(struct Command *command) {
-    char *commands[3] = {"exit", "cd", "status"};
+    char *commands[14] = {"exit", "cd", "status", "timeout", "batch", "export", "unset", "memstats", "pwd", "watch", "limit", "jobs", "wait", "pmap"};
     *(command->isBuiltin) = 0;
     for (int i = 0; i < sizeof(commands) / sizeof(char*); i++) {
         if (isEqualString(*(command->argv), *(commands + i))) {
@@ -228,6 +363,9 @@ void setIsBuiltinCommand(struct Command *command) {
             break;
         }
     }
+    if (isAssignment(*(command->argv))) {
+        *(command->isBuiltin) = 1;
+    }
 }
 
 /*
@@ -251,12 +389,17 @@ void initCommand(struct Command *command) {
     command->isStdinRedirection = NULL;
     command->isStdoutRedirection = NULL;
     command->isFailedRedirection = NULL;
+    command->isHereDocument = NULL;
     command->stdinFileArg = NULL;
     command->stdoutFileArg = NULL;
+    command->timeout = NULL;
     command->wordc = NULL;
     command->argc = NULL;
     command->wordv = NULL;
     command->argv = NULL;
+    command->envp = NULL;
+    command->hereDocument = NULL;
+    command->limits = NULL;
     command->stdinFile = NULL;
     command->stdoutFile = NULL;
 }
@@ -284,6 +427,7 @@ void printCommand(struct Command *command) {
  * For each command, call saveCommand() to store it to the command struct.
  */
 void parseCommand(char *buffer, struct Command *command, struct Shell *shell) {
+    MEMSTATS_SCOPE(MEMSTATS_PARSER);
     int length = stringLength(buffer);
     int wordc = 0;
     int argc = 0;
@@ -292,7 +436,9 @@ void parseCommand(char *buffer, struct Command *command, struct Shell *shell) {
     int isWord = 0;
     int isCommand = 0;
     int isExpectingFile = 0;
+    int depth = 0;
     char ch = '\0';
+    char *result;
 
     for (int i = 0; i < length; i++) {
         ch = *(buffer + i);
@@ -301,7 +447,13 @@ void parseCommand(char *buffer, struct Command *command, struct Shell *shell) {
             break;
         }
 
-        if (ch != ' ' && ch != '\t') {
+        if (ch == '(' && (depth > 0 || (count > 0 && *(buffer + i - 1) == '$'))) {
+            depth++;
+        } else if (ch == ')' && depth > 0) {
+            depth--;
+        }
+
+        if ((ch != ' ' && ch != '\t') || depth > 0) {
             if (count == 0) {
                 index = i;
             }
@@ -316,8 +468,21 @@ void parseCommand(char *buffer, struct Command *command, struct Shell *shell) {
         if (isWord) {
             if (isExpectingFile) {
                 isExpectingFile = 0;
+            } else if (*(buffer + index) == '<' && *(buffer + index + 1) == '<' && argc > 0 && count > 1) {
+                *(command->isStdinRedirection) = 0;
+                *(command->isHereDocument) = 1;
+                if (*(buffer + index + 2) == '<') {
+                    *(command->isHereDocument) = 2;
+                }
+                if (count == *(command->isHereDocument) + 1) {
+                    *(command->stdinFileArg) = wordc + 1;
+                    isExpectingFile = 1;
+                } else {
+                    *(command->stdinFileArg) = wordc;
+                }
             } else if (*(buffer + i - 1) == '<' && argc > 0 && count == 1) {
                 *(command->isStdinRedirection) = 1;
+                *(command->isHereDocument) = 0;
                 *(command->stdinFileArg) = wordc + 1;
                 isExpectingFile = 1;
             } else if (*(buffer + i - 1) == '>' && argc > 0 && count == 1) {
@@ -328,8 +493,14 @@ void parseCommand(char *buffer, struct Command *command, struct Shell *shell) {
                 argc++;
                 isCommand = 1;
             }
-            wordc++;
-            saveCommand(buffer, command, shell, index, count, wordc, argc, isCommand);
+            if (findSubstitution(buffer + index, count) != -1) {
+                result = parseSubstitution(buffer + index, count, shell);
+                saveSubstitution(result, command, shell, &wordc, &argc, isCommand);
+                free(result);
+            } else {
+                wordc++;
+                saveCommand(buffer, command, shell, index, count, wordc, argc, isCommand);
+            }
             count = 0;
             isWord = 0;
             isCommand = 0;
@@ -337,10 +508,287 @@ void parseCommand(char *buffer, struct Command *command, struct Shell *shell) {
     }
 }
 
+/*
+ * Find the first $( in the first length characters of buffer.
+ *
+ * Return its index, or -1 if there is none.
+ */
+int findSubstitution(char *buffer, int length) {
+    for (int i = 0; i < length - 1; i++) {
+        if (*(buffer + i) == '$' && *(buffer + i + 1) == '(') {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/*
+ * Replace every $(...) in the first length characters of buffer with the
+ * output of the command inside the parentheses.
+ *
+ * Trailing newlines of the output are removed. A $( without a matching
+ * parenthesis is kept as is. Nested substitutions are evaluated when the
+ * inner command is parsed.
+ *
+ * Return the dynamically allocated result.
+ */
+char *parseSubstitution(char *buffer, int length, struct Shell *shell) {
+    MEMSTATS_SCOPE(MEMSTATS_EXPANSION);
+    char *result = malloc(sizeof(char));
+    char *inner;
+    char *output;
+    int resultLength = 0;
+    int outputLength = 0;
+    int start = 0;
+    int end = 0;
+    int depth = 0;
+    int i = 0;
+
+    *result = '\0';
+    while (i < length) {
+        start = findSubstitution(buffer + i, length - i);
+        end = -1;
+        if (start != -1) {
+            start += i;
+            depth = 0;
+            for (int j = start + 1; j < length; j++) {
+                if (*(buffer + j) == '(') {
+                    depth++;
+                } else if (*(buffer + j) == ')') {
+                    depth--;
+                    if (depth == 0) {
+                        end = j;
+                        break;
+                    }
+                }
+            }
+        }
+        if (end == -1) {
+            result = appendExpansion(result, &resultLength, buffer + i, length - i, shell);
+            break;
+        }
+        result = appendExpansion(result, &resultLength, buffer + i, start - i, shell);
+
+        inner = malloc(sizeof(char) * (end - start - 1));
+        for (int j = start + 2; j < end; j++) {
+            *(inner + j - start - 2) = *(buffer + j);
+        }
+        *(inner + end - start - 2) = '\0';
+        output = captureCommand(inner, shell);
+        outputLength = stringLength(output);
+        while (outputLength > 0 && *(output + outputLength - 1) == '\n') {
+            outputLength--;
+        }
+
+        result = realloc(result, sizeof(char) * (resultLength + outputLength + 1));
+        for (int j = 0; j < outputLength; j++) {
+            *(result + resultLength) = *(output + j);
+            resultLength++;
+        }
+        *(result + resultLength) = '\0';
+        free(inner);
+        free(output);
+        i = end + 1;
+    }
+
+    return result;
+}
+
+/*
+ * Append the first length characters of buffer to result, with $$ expanded.
+ *
+ * Only the literal text around a substitution is expanded, never the output
+ * of the command.
+ *
+ * Return the reallocated result.
+ */
+char *appendExpansion(char *result, int *resultLength, char *buffer, int length, struct Shell *shell) {
+    char *literal = malloc(sizeof(char) * (length + 1));
+    char *expanded;
+    int expandedLength = 0;
+
+    memcpy(literal, buffer, length);
+    *(literal + length) = '\0';
+    expanded = parseExpansion(literal, shell);
+    expandedLength = stringLength(expanded);
+
+    result = realloc(result, sizeof(char) * (*resultLength + expandedLength + 1));
+    copyString(expanded, result + *resultLength);
+    *resultLength += expandedLength;
+
+    free(literal);
+    free(expanded);
+
+    return result;
+}
+
+/*
+ * Save the result of a substitution to the command struct.
+ *
+ * If the word is an argument, the result is split into words on whitespace,
+ * and each word is saved as an argument. Otherwise, e.g. for a redirection
+ * file, the whole result is saved as one word. The result is saved as is,
+ * since its literal text was expanded by parseSubstitution() and the output
+ * of a command must not be expanded again.
+ */
+void saveSubstitution(char *result, struct Command *command, struct Shell *shell, int *wordc, int *argc, int isCommand) {
+    char *word;
+    int length = stringLength(result);
+    int index = 0;
+    int count = 0;
+    char ch = '\0';
+
+    if (!isCommand) {
+        *wordc += 1;
+        word = malloc(sizeof(char) * (length + 1));
+        copyString(result, word);
+        saveWord(word, command, *wordc, *argc, isCommand);
+        return;
+    }
+
+    *argc -= 1;
+    for (int i = 0; i <= length; i++) {
+        ch = *(result + i);
+        if (ch != ' ' && ch != '\t' && ch != '\n' && ch != '\0') {
+            if (count == 0) {
+                index = i;
+            }
+            count++;
+        } else if (count > 0) {
+            *argc += 1;
+            *wordc += 1;
+            word = malloc(sizeof(char) * (count + 1));
+            memcpy(word, result + index, count);
+            *(word + count) = '\0';
+            saveWord(word, command, *wordc, *argc, isCommand);
+            count = 0;
+        }
+    }
+}
+
+/*
+ * Run a command and capture its stdout.
+ *
+ * Builtins that only print, such as pwd and status, run inside the shell
+ * with stdout pointed at a memory file, so no process is forked. Any other
+ * command runs in a child whose stdout is a pipe, and the output is read
+ * into a growable buffer. A builtin in a child behaves like it does in a
+ * subshell, so e.g. cd has no effect on the shell.
+ *
+ * Return the dynamically allocated output.
+ */
+char *captureCommand(char *line, struct Shell *shell) {
+    struct Command *command = malloc(sizeof(struct Command));
+    char *output = NULL;
+    int fds[2] = {-1, -1};
+    int savedStdin = -1;
+    int savedStdout = -1;
+    pid_t pid = 0;
+
+    initCommand(command);
+    parseCommand(line, command, shell);
+
+    if (command->wordc == NULL || *(command->argc) == 0) {
+        freeCommand(command);
+        output = malloc(sizeof(char));
+        *(output) = '\0';
+        return output;
+    }
+
+    addNullToCommandVector(command);
+    readHereDocument(command, shell);
+    setIsBuiltinCommand(command);
+    fflush(stdout);
+
+    if (*(command->isBuiltin) && isInProcessBuiltin(command)) {
+        fds[0] = memfd_create("smallsh-substitution", MFD_CLOEXEC);
+        if (fds[0] != -1) {
+            savedStdin = dup(STDIN_FILENO);
+            savedStdout = dup(STDOUT_FILENO);
+            dup2(fds[0], STDOUT_FILENO);
+            redirectStdin(command, shell);
+            redirectStdout(command, shell);
+            if (!*(command->isFailedRedirection)) {
+                runBuiltinCommand(command, shell);
+            }
+            fflush(stdout);
+            closeFiles(command);
+            dup2(savedStdin, STDIN_FILENO);
+            dup2(savedStdout, STDOUT_FILENO);
+            close(savedStdin);
+            close(savedStdout);
+            lseek(fds[0], 0, SEEK_SET);
+            output = readFileDescriptor(fds[0]);
+            close(fds[0]);
+        } else {
+            perror("memfd_create()");
+        }
+    } else if (pipe2(fds, O_CLOEXEC) == -1) {
+        perror("pipe()");
+    } else {
+        pid = fork();
+        switch (pid) {
+            case -1:
+                perror("fork()");
+                close(fds[0]);
+                close(fds[1]);
+                break;
+            case 0:
+                signal(SIGINT, SIG_DFL);
+                dup2(fds[1], STDOUT_FILENO);
+                redirectStdin(command, shell);
+                redirectStdout(command, shell);
+                if (!*(command->isFailedRedirection) && !*(command->isBuiltin)) {
+                    execExternalCommand(command, shell);
+                }
+                if (!*(command->isFailedRedirection)) {
+                    *(shell->backgroundPidCount) = 0;
+                    runBuiltinCommand(command, shell);
+                }
+                fflush(stdout);
+                _exit(*(command->isFailedRedirection) || *(shell->status) ? 1 : 0);
+            default:
+                close(fds[1]);
+                output = readFileDescriptor(fds[0]);
+                close(fds[0]);
+                while (waitpid(pid, NULL, 0) == -1 && errno == EINTR) {
+                }
+                break;
+        }
+    }
+
+    freeCommand(command);
+
+    if (output == NULL) {
+        output = malloc(sizeof(char));
+        *(output) = '\0';
+    }
+
+    return output;
+}
+
+/*
+ * Check if a builtin only prints output, and can therefore be captured
+ * without forking.
+ */
+int isInProcessBuiltin(struct Command *command) {
+    char *c = *(command->argv);
+    int count = countArguments(command->argv);
+
+    if (isEqualString(c, "status") || isEqualString(c, "pwd") || isEqualString(c, "memstats") || isEqualString(c, "jobs")) {
+        return 1;
+    }
+    if ((isEqualString(c, "export") || isEqualString(c, "timeout") || isEqualString(c, "limit")) && count == 1) {
+        return 1;
+    }
+    return 0;
+}
+
 /*
  *
  */
 char *parseExpansion(char *buffer, struct Shell *shell) {
+    MEMSTATS_SCOPE(MEMSTATS_EXPANSION);
     int hasExpanded = 0;
     int isExpansion = 0;
     int patternLength = 0;
@@ -433,15 +881,27 @@ void saveCommand(char *buffer, struct Command *command, struct Shell *shell, int
     *(temp + count) = '\0';
 
     str = parseExpansion(temp, shell);
+    saveWord(str, command, wordc, argc, isCommand);
+
+    free(temp);
+}
 
+/*
+ * Save a word, which is already expanded, to the command struct.
+ *
+ * The command struct takes ownership of the dynamically allocated word.
+ */
+void saveWord(char *str, struct Command *command, int wordc, int argc, int isCommand) {
     if (wordc == 1) {
         command->isBuiltin = malloc(sizeof(int));
         command->isBackground = malloc(sizeof(int));
         command->isStdinRedirection = malloc(sizeof(int));
         command->isStdoutRedirection = malloc(sizeof(int));
         command->isFailedRedirection = malloc(sizeof(int));
+        command->isHereDocument = malloc(sizeof(int));
         command->stdinFileArg = malloc(sizeof(int));
         command->stdoutFileArg = malloc(sizeof(int));
+        command->timeout = malloc(sizeof(int));
         command->argc = malloc(sizeof(int));
         command->wordc = malloc(sizeof(int));
         command->argv = malloc(sizeof(char*));
@@ -451,8 +911,10 @@ void saveCommand(char *buffer, struct Command *command, struct Shell *shell, int
         *(command->isStdinRedirection) = 0;
         *(command->isStdoutRedirection) = 0;
         *(command->isFailedRedirection) = 0;
+        *(command->isHereDocument) = 0;
         *(command->stdinFileArg) = -1;
         *(command->stdoutFileArg) = -1;
+        *(command->timeout) = -1;
     }
 
     if (isCommand) {
@@ -464,14 +926,13 @@ void saveCommand(char *buffer, struct Command *command, struct Shell *shell, int
     command->wordv = realloc(command->wordv, sizeof(char*) * wordc);
     *(command->wordc) = wordc;
     *(command->wordv + wordc - 1) = str;
-
-    free(temp);
 }
 
 /*
  *
  */
 void addNullToCommandVector(struct Command *command) {
+    MEMSTATS_SCOPE(MEMSTATS_PARSER);
     *(command->argc) += 1;
     command->argv = realloc(command->argv, sizeof(char*) * (*(command->argc)));
     *(command->argv + *(command->argc) - 1) = NULL;
@@ -492,13 +953,18 @@ void freeCommand(struct Command *command) {
         free(command->isStdinRedirection);
         free(command->isStdoutRedirection);
         free(command->isFailedRedirection);
+        free(command->isHereDocument);
+        free(command->hereDocument);
         free(command->stdinFileArg);
         free(command->stdoutFileArg);
+        free(command->timeout);
         free(command->argc);
         free(command->wordc);
         free(command->argv);
         free(command->wordv);
+        free(command->envp);
     }
+    freeLimits(command->limits);
     free(command);
 }
 
@@ -515,25 +981,144 @@ void runBuiltinCommand(struct Command *command, struct Shell *shell) {
         runBuiltinCommandCd(command, shell);
     } else if (isEqualString(c, "status")) {
         runBuiltinCommandStatus(command, shell);
+    } else if (isEqualString(c, "timeout")) {
+        runBuiltinCommandTimeout(command, shell);
+    } else if (isEqualString(c, "batch")) {
+        runBuiltinCommandBatch(command, shell);
+    } else if (isEqualString(c, "export")) {
+        runBuiltinCommandExport(command, shell);
+    } else if (isEqualString(c, "unset")) {
+        runBuiltinCommandUnset(command, shell);
+    } else if (isEqualString(c, "memstats")) {
+        runBuiltinCommandMemstats(command, shell);
+    } else if (isEqualString(c, "pwd")) {
+        runBuiltinCommandPwd(command, shell);
+    } else if (isEqualString(c, "watch")) {
+        runBuiltinCommandWatch(command, shell);
+    } else if (isEqualString(c, "limit")) {
+        runBuiltinCommandLimit(command, shell);
+    } else if (isEqualString(c, "jobs")) {
+        runBuiltinCommandJobs(command, shell);
+    } else if (isEqualString(c, "wait")) {
+        runBuiltinCommandWait(command, shell);
+    } else if (isEqualString(c, "pmap")) {
+        runBuiltinCommandPmap(command, shell);
+    } else if (isAssignment(c)) {
+        runBuiltinCommandAssignment(command, shell);
     }
 }
 
 /*
- * Set the isRunning flag to 0.
+ * Set the isRunning flag to 0, and terminate the background jobs.
  *
  * The shell will terminate accordingly.
  */
 void runBuiltinCommandExit(struct Command *command, struct Shell *shell) {
     *(shell->isRunning) = 0;
     if (*(shell->backgroundPidCount)) {
-        printf("pids running in background: %d\n", *(shell->backgroundPidCount));
-        for (int i = 0; i < *(shell->backgroundPidCount); i++) {
-            printf("killing pid %d\n", *(*(shell->backgroundPids + i)));
-            if (*(*(shell->backgroundPids + i))) {
-                kill(*(*(shell->backgroundPids + i)), SIGKILL);
+        terminateBackgroundPids(shell);
+    }
+}
+
+/*
+ * Terminate every background job and reap it within the grace period.
+ *
+ * Each job leads its own process group, so a single SIGTERM per group also
+ * reaches the processes the job started. The jobs are then polled together
+ * through pidfds, which become readable once a job has exited but leave it
+ * unreaped, and the jobs still running are counted down as they exit. Jobs
+ * whose pidfd could not be opened are swept every 50 ms instead. Only the
+ * jobs that are still running once the grace period ends are printed.
+ *
+ * Then every group is sent SIGKILL, which also reaches the processes a job
+ * left behind, before any job is reaped. A zombie leader keeps its group id
+ * from being reused, so the SIGKILL cannot reach an unrelated group, and the
+ * jobs die in parallel rather than one per waitpid().
+ */
+void terminateBackgroundPids(struct Shell *shell) {
+    siginfo_t info;
+    long remaining = 0;
+    long deadline = 0;
+    int count = *(shell->backgroundPidCount);
+    int running = count;
+    int status = 0;
+    int index = 0;
+    int pollTimeout = 0;
+    int isExited = 0;
+    struct pollfd *pidfds = malloc(sizeof(struct pollfd) * (count + 1));
+    pid_t *pids = malloc(sizeof(pid_t) * (count + 1));
+    pid_t pid;
+
+    for (int i = 0; i < count; i++) {
+        *(pids + i) = *(*(shell->backgroundPids + i));
+        if (killpg(*(pids + i), SIGTERM) == -1) {
+            kill(*(pids + i), SIGTERM);
+        }
+        (pidfds + i)->fd = openPidfd(*(pids + i));
+        (pidfds + i)->events = POLLIN;
+        (pidfds + i)->revents = 0;
+    }
+
+    deadline = getMonotonicMilliseconds() + *(shell->GRACE_PERIOD);
+    while (running > 0) {
+        remaining = deadline - getMonotonicMilliseconds();
+        if (remaining <= 0) {
+            break;
+        }
+        pollTimeout = remaining;
+        for (int i = 0; i < running && pollTimeout > 50; i++) {
+            if ((pidfds + i)->fd == -1) {
+                pollTimeout = 50;
+            }
+        }
+        if (poll(pidfds, running, pollTimeout) == -1 && errno != EINTR) {
+            break;
+        }
+
+        index = 0;
+        for (int i = 0; i < running; i++) {
+            if ((pidfds + i)->fd != -1) {
+                isExited = (pidfds + i)->revents != 0;
+            } else {
+                info.si_pid = 0;
+                isExited = waitid(P_PID, *(pids + i), &info, WEXITED | WNOHANG | WNOWAIT) == -1 || info.si_pid != 0;
             }
+            if (isExited && (pidfds + i)->fd != -1) {
+                close((pidfds + i)->fd);
+            } else if (!isExited) {
+                *(pidfds + index) = *(pidfds + i);
+                *(pids + index) = *(pids + i);
+                index++;
+            }
+        }
+        running = index;
+    }
+
+    for (int i = 0; i < running; i++) {
+        printf("killing pid %d\n", *(pids + i));
+        if ((pidfds + i)->fd != -1) {
+            close((pidfds + i)->fd);
+        }
+    }
+    fflush(stdout);
+
+    for (int i = 0; i < count; i++) {
+        pid = *(*(shell->backgroundPids + i));
+        if (killpg(pid, SIGKILL) == -1) {
+            kill(pid, SIGKILL);
         }
     }
+    for (int i = 0; i < count; i++) {
+        pid = *(*(shell->backgroundPids + i));
+        waitpid(pid, &status, 0);
+        removeCgroupJob(shell->cgroup, pid);
+        removeBoardJob(shell->board, pid);
+        free(*(shell->backgroundPids + i));
+    }
+    *(shell->backgroundPidCount) = 0;
+    *(shell->isRunningBackgroundProcess) = 0;
+    free(pidfds);
+    free(pids);
 }
 
 /*
@@ -564,84 +1149,1618 @@ void runBuiltinCommandCd(struct Command *command, struct Shell *shell) {
  * not including builtin commands.
  */
 void runBuiltinCommandStatus(struct Command *command, struct Shell *shell) {
-    printf("exit value %d\n", *(shell->status));
+    if (*(shell->isTimedOut)) {
+        printf("exit value %d (timed out)\n", *(shell->status));
+    } else {
+        printf("exit value %d\n", *(shell->status));
+    }
 }
 
 /*
+ * Run a command with a deadline, or manage the shell-wide default deadline.
  *
+ * timeout                  print the default deadline
+ * timeout DURATION         set the default deadline, 0 disables it
+ * timeout DURATION cmd...  run cmd with its own deadline
+ *
+ * The deadline is enforced by the shell itself while it waits for the
+ * foreground process, so no wrapper process is forked.
  */
-void runExternalCommandForeground(struct Command *command, struct Shell *shell) {
-    pid_t pid = fork();
+void runBuiltinCommandTimeout(struct Command *command, struct Shell *shell) {
+    int count = countArguments(command->argv);
+    int timeout = 0;
 
-    switch (pid) {
-        case -1:
-            perror("fork()");
-            break;
-        case 0:
-            signal(SIGINT, SIG_DFL);
-            signal(SIGTSTP, SIG_IGN);
-            execvp(*(command->argv), command->argv);
-            perror("execvp()");
-            resetOutput(shell);
-            freeCommand(command);
-            freeShell(shell);
-            kill(getpid(), SIGKILL);
-            break;
-        default:
-            pid = waitpid(pid, shell->status, 0);
-            if (WIFSIGNALED(*(shell->status))) {
-                printf("pid %d terminated by signal %d\n", pid, *(shell->status));
-            }
-            break;
+    if (count == 1) {
+        if (*(shell->timeout)) {
+            printf("default timeout %d ms\n", *(shell->timeout));
+        } else {
+            printf("no default timeout\n");
+        }
+        fflush(stdout);
+        return;
+    }
+
+    timeout = parseDuration(*(command->argv + 1));
+    if (timeout == -1) {
+        fprintf(stderr, "timeout: invalid duration %s\n", *(command->argv + 1));
+        *(shell->status) = 1;
+        *(shell->isTimedOut) = 0;
+        return;
+    }
+
+    if (count == 2) {
+        *(shell->timeout) = timeout;
+        return;
     }
+
+    if (*(command->isBackground)) {
+        fprintf(stderr, "timeout: deadlines apply to foreground commands only\n");
+    }
+    if (*(command->timeout) == -1 || timeout < *(command->timeout)) {
+        *(command->timeout) = timeout;
+    }
+    runPrefixedCommand(command, shell, 2);
 }
 
 /*
+ * Run the command that follows the first shift words of a prefix builtin.
  *
+ * For example, timeout 5 sleep 10 runs sleep 10. The argument vector is
+ * replaced with a shifted copy for the duration of the call, so that a child
+ * which fails to exec can still free the command struct.
  */
-void runExternalCommandBackground(struct Command *command, struct Shell *shell) {
-    int count = *(shell->backgroundPidCount) + 1;
-    int temp[count];
-    pid_t pid = fork();
+void runPrefixedCommand(struct Command *command, struct Shell *shell, int shift) {
+    char **argv = command->argv;
+    int argc = *(command->argc);
+    int count = countArguments(argv);
 
-    switch (pid) {
-        case -1:
-            perror("fork()");
-            break;
-        case 0:
-            signal(SIGTSTP, SIG_IGN);
-            execvp(*(command->argv), command->argv);
-            perror("execvp()");
-            resetOutput(shell);
-            freeCommand(command);
-            freeShell(shell);
-            kill(getpid(), SIGKILL);
-            break;
-        default:
-            for (int i = 0; i < count - 1; i++) {
-                temp[i] = *(*(shell->backgroundPids + i));
-                free(*(shell->backgroundPids + i));
-            }
+    if (count <= shift) {
+        return;
+    }
 
-            shell->backgroundPids = realloc(shell->backgroundPids, sizeof(int*) * count);
-            *(shell->backgroundPidCount) = count;
+    command->argv = malloc(sizeof(char*) * (count - shift + 1));
+    for (int i = 0; i <= count - shift; i++) {
+        *(command->argv + i) = *(argv + shift + i);
+    }
+    *(command->argc) = count - shift + 1;
 
-            for (int i = 0; i < count; i++) {
-                *(shell->backgroundPids + i) = malloc(sizeof(int));
+    setIsBuiltinCommand(command);
+    if (*(command->isBuiltin)) {
+        runBuiltinCommand(command, shell);
+    } else if (*(command->isBackground)) {
+        runExternalCommandBackground(command, shell);
+    } else {
+        runExternalCommandForeground(command, shell);
+    }
 
-                if (i == count - 1) {
-                    *(*(shell->backgroundPids + i)) = pid;
-                } else {
-                    *(*(shell->backgroundPids + i)) = temp[i];
-                }
+    free(command->argv);
+    command->argv = argv;
+    *(command->argc) = argc;
+    *(command->isBuiltin) = 1;
+}
+
+/*
+ * Export variables to the environment of subsequent commands.
+ *
+ * Without arguments, print every exported variable. Arguments of the form
+ * NAME=value set the variable, while a bare NAME is already exported if it
+ * is set at all.
+ */
+void runBuiltinCommandExport(struct Command *command, struct Shell *shell) {
+    char **envp;
+    int count = countArguments(command->argv);
+    int status = 0;
+
+    if (count == 1) {
+        envp = getEnvironmentVector(shell->environment);
+        for (int i = 0; *(envp + i) != NULL; i++) {
+            printf("export %s\n", *(envp + i));
+        }
+        fflush(stdout);
+        return;
+    }
+
+    for (int i = 1; i < count; i++) {
+        if (isAssignment(*(command->argv + i))) {
+            setVariable(shell->environment, *(command->argv + i));
+            syncShellVariable(*(command->argv + i), shell);
+        } else if (!isVariableName(*(command->argv + i), stringLength(*(command->argv + i)))) {
+            fprintf(stderr, "export: not a valid identifier: %s\n", *(command->argv + i));
+            status = 1;
+        }
+    }
+
+    getEnvironmentVector(shell->environment);
+    *(shell->status) = status;
+    *(shell->isTimedOut) = 0;
+}
+
+/*
+ * Remove variables from the environment of subsequent commands.
+ */
+void runBuiltinCommandUnset(struct Command *command, struct Shell *shell) {
+    int count = countArguments(command->argv);
+
+    for (int i = 1; i < count; i++) {
+        unsetVariable(shell->environment, *(command->argv + i));
+        syncShellVariable(*(command->argv + i), shell);
+    }
+
+    getEnvironmentVector(shell->environment);
+}
+
+/*
+ * Run a command prefixed with NAME=value assignments, e.g. TZ=UTC date.
+ *
+ * The assignments only apply to the environment of that command, which is
+ * a shallow copy of the cached envp vector with the assigned entries
+ * replaced. Without a command, the assignments update variables that are
+ * already exported and are otherwise ignored, as smallsh has no unexported
+ * variables.
+ */
+void runBuiltinCommandAssignment(struct Command *command, struct Shell *shell) {
+    int count = countArguments(command->argv);
+    int assignments = 0;
+
+    while (assignments < count && isAssignment(*(command->argv + assignments))) {
+        assignments++;
+    }
+
+    if (assignments == count) {
+        for (int i = 0; i < count; i++) {
+            if (findVariable(shell->environment, *(command->argv + i),\
+            getVariableNameLength(*(command->argv + i))) != NULL) {
+                setVariable(shell->environment, *(command->argv + i));
+                syncShellVariable(*(command->argv + i), shell);
+            }
+        }
+        getEnvironmentVector(shell->environment);
+        return;
+    }
+
+    free(command->envp);
+    command->envp = getOverrideVector(shell->environment, command->argv, assignments);
+    runPrefixedCommand(command, shell, assignments);
+    free(command->envp);
+    command->envp = NULL;
+}
+
+/*
+ * Mirror a change to HOME or PATH into the shell itself.
+ *
+ * cd uses the HOME of the shell struct, and execvpe() searches the PATH of
+ * the shell process rather than the envp it is given. The entry is either
+ * NAME=value or, for an unset variable, NAME.
+ */
+void syncShellVariable(char *entry, struct Shell *shell) {
+    int nameLength = getVariableNameLength(entry);
+    char *value = entry + nameLength + 1;
+
+    if (nameLength == 4 && strncmp(entry, "HOME", 4) == 0) {
+        if (*(entry + nameLength) == '=' && stringLength(value) < *(shell->MAX_LENGTH)) {
+            copyString(value, shell->HOME);
+        }
+    } else if (nameLength == 4 && strncmp(entry, "PATH", 4) == 0) {
+        if (*(entry + nameLength) == '=') {
+            setenv("PATH", value, 1);
+        } else {
+            unsetenv("PATH");
+        }
+    }
+}
+
+/*
+ * Print the current working directory.
+ */
+void runBuiltinCommandPwd(struct Command *command, struct Shell *shell) {
+    if (shell->cwd == NULL) {
+        shell->cwd = malloc(sizeof(char) * *(shell->MAX_LENGTH));
+        shell->cwd = getcwd(shell->cwd, *(shell->MAX_LENGTH));
+    }
+    if (shell->cwd != NULL) {
+        printf("%s\n", shell->cwd);
+        fflush(stdout);
+    } else {
+        perror("pwd");
+    }
+}
+
+/*
+ * Print the allocation counters of the shell process.
+ *
+ * The counters are only kept when smallsh is built with make MEMSTATS=1.
+ */
+void runBuiltinCommandMemstats(struct Command *command, struct Shell *shell) {
+    if (isMemstatsEnabled()) {
+        printMemstats(stdout);
+    } else {
+        printf("memstats: not enabled, rebuild with make MEMSTATS=1\n");
+    }
+    fflush(stdout);
+}
+
+/*
+ * Set the cgroup limits of jobs.
+ *
+ * limit                 print the default limits of background jobs
+ * limit LIMITS...       set the default limits of background jobs
+ * limit LIMITS... cmd   run cmd with LIMITS on top of the defaults
+ *
+ * See parseLimit() for the form of each limit.
+ */
+void runBuiltinCommandLimit(struct Command *command, struct Shell *shell) {
+    struct Limits *previous = command->limits;
+    struct Limits *limits;
+    char *controllers[3] = {"memory", "cpu", "io"};
+    char *keys[3] = {"mem=", "cpu=", "io="};
+    int isUsed[3] = {0, 0, 0};
+    int count = countArguments(command->argv);
+    int index = 1;
+
+    if (count == 1) {
+        printLimits(shell->cgroup->limits);
+        return;
+    }
+
+    limits = copyLimits(previous != NULL ? previous : shell->cgroup->limits);
+    for (; index < count && isLimit(*(command->argv + index)); index++) {
+        if (parseLimit(limits, *(command->argv + index)) == -1) {
+            fprintf(stderr, "limit: invalid limit %s\n", *(command->argv + index));
+            freeLimits(limits);
+            *(shell->status) = 1;
+            *(shell->isTimedOut) = 0;
+            return;
+        }
+        for (int i = 0; i < 3; i++) {
+            if (strncmp(*(command->argv + index), *(keys + i), stringLength(*(keys + i))) == 0) {
+                *(isUsed + i) = 1;
+            }
+        }
+    }
+
+    if (shell->cgroup->path == NULL) {
+        fprintf(stderr, "limit: no writable cgroup v2 hierarchy, jobs run unconfined\n");
+    } else {
+        for (int i = 0; i < 3; i++) {
+            if (*(isUsed + i) && !hasCgroupController(shell->cgroup, *(controllers + i))) {
+                fprintf(stderr, "limit: %s controller is not delegated\n", *(controllers + i));
+            }
+        }
+    }
+
+    if (index == count) {
+        freeLimits(shell->cgroup->limits);
+        shell->cgroup->limits = limits;
+        return;
+    }
+
+    command->limits = limits;
+    runPrefixedCommand(command, shell, index);
+    command->limits = previous;
+    freeLimits(limits);
+}
+
+/*
+ * List the background jobs with the peak memory and CPU time of their
+ * cgroup leaves.
+ */
+void runBuiltinCommandJobs(struct Command *command, struct Shell *shell) {
+    long memoryPeak = 0;
+    long cpuUsage = 0;
+    char value[32];
+    char *name;
+    pid_t pid = 0;
+
+    printf("%-8s %-12s %-10s %s\n", "PID", "MEM.PEAK", "CPU", "COMMAND");
+    for (int i = 0; i < *(shell->backgroundPidCount); i++) {
+        pid = *(*(shell->backgroundPids + i));
+        readCgroupJob(shell->cgroup, pid, &memoryPeak, &cpuUsage);
+        name = findBoardJob(shell->board, pid);
+        printf("%-8d ", pid);
+        if (memoryPeak == -1) {
+            printf("%-12s ", "-");
+        } else {
+            printf("%-12ld ", memoryPeak);
+        }
+        if (cpuUsage == -1) {
+            snprintf(value, sizeof(value), "-");
+        } else {
+            snprintf(value, sizeof(value), "%.2fs", cpuUsage / 1000000.0);
+        }
+        printf("%-10s %s\n", value, name != NULL ? name : "-");
+    }
+    fflush(stdout);
+}
+
+/*
+ * Count the arguments before the null terminator of an argument vector.
+ *
+ * Unlike argc, this excludes an & that was replaced with a null pointer.
+ */
+int countArguments(char **argv) {
+    int count = 0;
+    while (*(argv + count) != NULL) {
+        count++;
+    }
+    return count;
+}
+
+/*
+ *
+ */
+void runExternalCommandForeground(struct Command *command, struct Shell *shell) {
+    struct Limits *limits = getJobLimits(command, shell);
+    int sync[2] = {-1, -1};
+    int reason = 0;
+    pid_t pid = 0;
+
+    if (limits != NULL && pipe2(sync, O_CLOEXEC) == -1) {
+        limits = NULL;
+    }
+    pid = fork();
+
+    switch (pid) {
+        case -1:
+            perror("fork()");
+            placeJobCgroup(pid, limits, sync, shell);
+            break;
+        case 0:
+            enterJobCgroup(sync);
+            signal(SIGINT, SIG_DFL);
+            execExternalCommand(command, shell);
+            break;
+        default:
+            placeJobCgroup(pid, limits, sync, shell);
+            setBoardForeground(shell->board, pid, command->argv);
+            /* The child holds its own copy of a redirected stdin, so the
+             * script can be read ahead from the shell's stdin meanwhile. */
+            dup2(*(shell->STDIN_FD), STDIN_FILENO);
+            prefetchLookahead(shell->lookahead);
+            if (*(command->timeout) != -1) {
+                reason = waitForegroundPid(pid, *(command->timeout), *(shell->watchFd), shell);
+            } else {
+                reason = waitForegroundPid(pid, *(shell->timeout), *(shell->watchFd), shell);
+            }
+            *(shell->isTimedOut) = reason == 1;
+            setBoardForeground(shell->board, 0, NULL);
+            if (limits != NULL) {
+                removeCgroupJob(shell->cgroup, pid);
+            }
+            if (reason == 1) {
+                printf("pid %d timed out and was terminated by signal %d\n", pid, *(shell->status));
+            } else if (reason == 2) {
+                printf("pid %d was cancelled by a change and terminated by signal %d\n", pid, *(shell->status));
+            } else if (WIFSIGNALED(*(shell->status))) {
+                printf("pid %d terminated by signal %d\n", pid, *(shell->status));
+            }
+            break;
+    }
+}
+
+/*
+ * Wait for a foreground process, terminating it if it exceeds timeout ms or
+ * if cancelFd becomes readable.
+ *
+ * The process is polled through a pidfd, together with cancelFd and with the
+ * time left until the deadline as the poll timeout. Once the deadline passes
+ * or cancelFd is readable, the process is sent SIGTERM, and if it is still
+ * running after the grace period, SIGKILL. Without a deadline or cancelFd, or
+ * on a kernel without pidfds, fall back to a blocking waitpid().
+ *
+ * If the process was terminated for exceeding the deadline, return 1. If it
+ * was cancelled, return 2. Otherwise, return 0.
+ */
+int waitForegroundPid(pid_t pid, int timeout, int cancelFd, struct Shell *shell) {
+    struct pollfd fds[2] = {{0}};
+    long deadline = -1;
+    long remaining = 0;
+    int reason = 0;
+    int result = 0;
+
+    fds[0].fd = -1;
+    if (timeout > 0 || cancelFd != -1) {
+        fds[0].fd = openPidfd(pid);
+    }
+
+    if (fds[0].fd != -1) {
+        fds[0].events = POLLIN;
+        fds[1].fd = cancelFd;
+        fds[1].events = POLLIN;
+        if (timeout > 0) {
+            deadline = getMonotonicMilliseconds() + timeout;
+        }
+        while (1) {
+            remaining = -1;
+            if (deadline != -1) {
+                remaining = deadline - getMonotonicMilliseconds();
+            }
+            if (deadline != -1 && remaining <= 0) {
+                if (reason) {
+                    kill(pid, SIGKILL);
+                    deadline = -1;
+                } else {
+                    kill(pid, SIGTERM);
+                    reason = 1;
+                    deadline = getMonotonicMilliseconds() + *(shell->GRACE_PERIOD);
+                }
+                continue;
+            }
+            result = poll(fds, 2, remaining);
+            if (result > 0 && fds[0].revents) {
+                break;
+            } else if (result > 0 && fds[1].revents && !reason) {
+                kill(pid, SIGTERM);
+                reason = 2;
+                deadline = getMonotonicMilliseconds() + *(shell->GRACE_PERIOD);
+                fds[1].fd = -1;
+            } else if (result == -1 && errno != EINTR) {
+                break;
+            }
+        }
+        close(fds[0].fd);
+    }
+
+    waitpid(pid, shell->status, 0);
+
+    return reason;
+}
+
+/*
+ *
+ */
+void runExternalCommandBackground(struct Command *command, struct Shell *shell) {
+    MEMSTATS_SCOPE(MEMSTATS_JOBS);
+    struct Limits *limits = getJobLimits(command, shell);
+    int count = *(shell->backgroundPidCount) + 1;
+    int temp[count];
+    int sync[2] = {-1, -1};
+    pid_t pid = 0;
+
+    if (limits != NULL && pipe2(sync, O_CLOEXEC) == -1) {
+        limits = NULL;
+    }
+    pid = fork();
+
+    switch (pid) {
+        case -1:
+            perror("fork()");
+            placeJobCgroup(pid, limits, sync, shell);
+            break;
+        case 0:
+            setpgid(0, 0);
+            enterJobCgroup(sync);
+            execExternalCommand(command, shell);
+            break;
+        default:
+            setpgid(pid, pid);
+            placeJobCgroup(pid, limits, sync, shell);
+            for (int i = 0; i < count - 1; i++) {
+                temp[i] = *(*(shell->backgroundPids + i));
+                free(*(shell->backgroundPids + i));
+            }
+
+            shell->backgroundPids = realloc(shell->backgroundPids, sizeof(int*) * count);
+            *(shell->backgroundPidCount) = count;
+
+            for (int i = 0; i < count; i++) {
+                *(shell->backgroundPids + i) = malloc(sizeof(int));
+
+                if (i == count - 1) {
+                    *(*(shell->backgroundPids + i)) = pid;
+                } else {
+                    *(*(shell->backgroundPids + i)) = temp[i];
+                }
+            }
+
+            addBoardJob(shell->board, pid, command->argv);
+            printf("background pid is %d\n", pid);
+            fflush(stdout);
+
+            *(shell->isRunningBackgroundProcess) = 1;
+            break;
+    }
+}
+
+/*
+ * Replace the forked child with the external command.
+ *
+ * If the exec fails, free the child's copy of the shell and terminate it.
+ */
+void execExternalCommand(struct Command *command, struct Shell *shell) {
+    signal(SIGTSTP, SIG_IGN);
+    if (command->envp != NULL) {
+        execvpe(*(command->argv), command->argv, command->envp);
+    } else {
+        execvpe(*(command->argv), command->argv, getEnvironmentVector(shell->environment));
+    }
+    perror("execvp()");
+    resetOutput(shell);
+    freeCommand(command);
+    freeShell(shell);
+    kill(getpid(), SIGKILL);
+}
+
+/*
+ * Wait for background jobs to finish.
+ *
+ * wait [-n] [-t DURATION] [PID...]
+ *
+ * Without PIDs, wait for every background job. With -n, return as soon as
+ * the first of them finishes. With -t, give up once DURATION has passed, and
+ * mark the status as timed out. A PID that is listed twice is waited for
+ * once. Finished jobs are reaped and removed from the table, and the status
+ * is that of the first job to fail, or 0 if every job succeeded. A job that
+ * is no longer a child of the shell is dropped without a status.
+ *
+ * The jobs are polled together through pidfds, with a 50 ms fallback sweep
+ * for jobs whose pidfd could not be opened. SIGTSTP still toggles
+ * foreground-only mode while waiting, and SIGINT stays ignored.
+ */
+void runBuiltinCommandWait(struct Command *command, struct Shell *shell) {
+    char **argv = command->argv;
+    int count = countArguments(argv);
+    int isAny = 0;
+    int timeout = -1;
+    int index = 1;
+    int running = 0;
+    int finished = 0;
+    int status = 0;
+    int jobStatus = 0;
+    int pollTimeout = 0;
+    int isListed = 0;
+    int result = 0;
+    long deadline = -1;
+    long remaining = 0;
+    struct pollfd *pidfds;
+    pid_t *pids;
+    pid_t pid = 0;
+
+    for (; index < count && **(argv + index) == '-'; index++) {
+        if (isEqualString(*(argv + index), "-n")) {
+            isAny = 1;
+        } else if (isEqualString(*(argv + index), "-t") && index + 1 < count && parseDuration(*(argv + index + 1)) != -1) {
+            index++;
+            timeout = parseDuration(*(argv + index));
+        } else {
+            fprintf(stderr, "usage: wait [-n] [-t duration] [pid...]\n");
+            *(shell->status) = 1;
+            *(shell->isTimedOut) = 0;
+            return;
+        }
+    }
+
+    pids = malloc(sizeof(pid_t) * (index < count ? count - index : *(shell->backgroundPidCount) + 1));
+    if (index < count) {
+        for (int i = index; i < count; i++) {
+            pid = atoi(*(argv + i));
+            isListed = 0;
+            for (int j = 0; j < running; j++) {
+                if (*(pids + j) == pid) {
+                    isListed = 1;
+                }
+            }
+            if (findBackgroundPid(shell, pid) == -1) {
+                fprintf(stderr, "wait: pid %s is not a background job of this shell\n", *(argv + i));
+                status = 1;
+            } else if (!isListed) {
+                *(pids + running) = pid;
+                running++;
+            }
+        }
+    } else {
+        for (int i = 0; i < *(shell->backgroundPidCount); i++) {
+            *(pids + running) = *(*(shell->backgroundPids + i));
+            running++;
+        }
+    }
+
+    pidfds = malloc(sizeof(struct pollfd) * (running + 1));
+    for (int i = 0; i < running; i++) {
+        (pidfds + i)->fd = openPidfd(*(pids + i));
+        (pidfds + i)->events = POLLIN;
+        (pidfds + i)->revents = 0;
+    }
+    if (timeout != -1) {
+        deadline = getMonotonicMilliseconds() + timeout;
+    }
+
+    *(shell->isTimedOut) = 0;
+    while (running > 0 && !(isAny && finished)) {
+        pollTimeout = -1;
+        for (int i = 0; i < running; i++) {
+            if ((pidfds + i)->fd == -1) {
+                pollTimeout = 50;
+            }
+        }
+        if (deadline != -1) {
+            remaining = deadline - getMonotonicMilliseconds();
+            if (remaining <= 0) {
+                *(shell->isTimedOut) = 1;
+                break;
+            }
+            if (pollTimeout == -1 || remaining < pollTimeout) {
+                pollTimeout = remaining;
+            }
+        }
+
+        result = poll(pidfds, running, pollTimeout);
+        if (result == -1 && errno == EINTR) {
+            continue;
+        }
+        for (int i = 0; i < running; i++) {
+            if ((pidfds + i)->fd != -1 && !((pidfds + i)->revents & (POLLIN | POLLNVAL))) {
+                continue;
+            }
+            pid = waitpid(*(pids + i), &jobStatus, WNOHANG);
+            if (pid == 0 || (pid == -1 && errno != ECHILD)) {
+                continue;
+            } else if (pid > 0) {
+                printf("background pid %d returned with exit value %d\n", *(pids + i), jobStatus);
+                if (isAny) {
+                    status = jobStatus;
+                } else if (jobStatus && !status) {
+                    status = jobStatus;
+                }
+                finished++;
+            }
+            removeBackgroundPid(shell, findBackgroundPid(shell, *(pids + i)));
+            if ((pidfds + i)->fd != -1) {
+                close((pidfds + i)->fd);
+            }
+            running--;
+            *(pids + i) = *(pids + running);
+            *(pidfds + i) = *(pidfds + running);
+            i--;
+        }
+    }
+    fflush(stdout);
+
+    if (*(shell->isTimedOut)) {
+        fprintf(stderr, "wait: timed out with %d jobs running\n", running);
+    }
+    for (int i = 0; i < running; i++) {
+        if ((pidfds + i)->fd != -1) {
+            close((pidfds + i)->fd);
+        }
+    }
+    free(pidfds);
+    free(pids);
+
+    *(shell->status) = status;
+}
+
+/*
+ * Get the limits to confine a job with, or NULL if it runs unconfined.
+ *
+ * Background jobs always get a leaf, so that jobs can report their usage.
+ * Foreground commands only get one when run under a limit prefix.
+ */
+struct Limits *getJobLimits(struct Command *command, struct Shell *shell) {
+    if (shell->cgroup->path == NULL) {
+        return NULL;
+    } else if (command->limits != NULL) {
+        return command->limits;
+    } else if (*(command->isBackground)) {
+        return shell->cgroup->limits;
+    }
+    return NULL;
+}
+
+/*
+ * Block the forked child until the parent has moved it into its leaf, which
+ * the parent signals by closing its end of the sync pipe.
+ */
+void enterJobCgroup(int *sync) {
+    char c;
+
+    if (*sync == -1) {
+        return;
+    }
+    close(*(sync + 1));
+    while (read(*sync, &c, 1) == -1 && errno == EINTR) {
+    }
+    close(*sync);
+}
+
+/*
+ * Move a forked job into its own leaf, then release it to exec.
+ *
+ * If fork failed, only close the sync pipe.
+ */
+void placeJobCgroup(pid_t pid, struct Limits *limits, int *sync, struct Shell *shell) {
+    if (limits == NULL) {
+        return;
+    }
+    close(*sync);
+    if (pid > 0 && addCgroupJob(shell->cgroup, limits, pid) == -1) {
+        fprintf(stderr, "limit: could not move pid %d into a cgroup\n", pid);
+    }
+    close(*(sync + 1));
+}
+
+/*
+ * Run an external command over a long list of arguments, xargs style.
+ *
+ * batch [-j N] cmd [args...] [-- args...]
+ *
+ * The arguments after -- (or after cmd, if there is no --) are split into
+ * the fewest chunks whose argument and environment strings fit within
+ * ARG_MAX, and cmd is run once per chunk with the leading arguments
+ * repeated. Chunks run one after another through the foreground path, or
+ * over N parallel slots with -j. The status is that of the first chunk to
+ * fail, or 0 if every chunk succeeded.
+ */
+void runBuiltinCommandBatch(struct Command *command, struct Shell *shell) {
+    char **argv = command->argv;
+    int argc = *(command->argc);
+    int count = countArguments(argv);
+    int slots = 1;
+    int first = 1;
+    int fixedCount = 0;
+    int trailing = 0;
+    int index = 0;
+    int chunkCount = 0;
+    int status = 0;
+    long budget = 0;
+    long size = 0;
+    long argumentSize = 0;
+
+    if (count > 2 && isEqualString(*(argv + 1), "-j")) {
+        slots = atoi(*(argv + 2));
+        first = 3;
+        if (slots < 1) {
+            fprintf(stderr, "batch: invalid slot count %s\n", *(argv + 2));
+            *(shell->status) = 1;
+            *(shell->isTimedOut) = 0;
+            return;
+        }
+    }
+
+    if (count <= first) {
+        fprintf(stderr, "batch: usage: batch [-j N] cmd [args...] [-- args...]\n");
+        *(shell->status) = 1;
+        *(shell->isTimedOut) = 0;
+        return;
+    }
+
+    trailing = first + 1;
+    for (int i = first + 1; i < count; i++) {
+        if (isEqualString(*(argv + i), "--")) {
+            trailing = i + 1;
+            break;
+        }
+    }
+    fixedCount = trailing - first;
+    if (trailing > first + 1) {
+        fixedCount--;
+    }
+
+    if (command->envp != NULL) {
+        budget = sysconf(_SC_ARG_MAX) - getVectorSize(command->envp) - 2048;
+    } else {
+        budget = sysconf(_SC_ARG_MAX) - *(shell->environment->size) - 2048;
+    }
+    for (int i = first; i < first + fixedCount; i++) {
+        budget -= stringLength(*(argv + i)) + 1 + sizeof(char*);
+    }
+    budget -= sizeof(char*);
+
+    command->argv = malloc(sizeof(char*) * (fixedCount + count - trailing + 1));
+    for (int i = 0; i < fixedCount; i++) {
+        *(command->argv + i) = *(argv + first + i);
+    }
+
+    index = trailing;
+    do {
+        chunkCount = 0;
+        size = 0;
+        while (index < count) {
+            argumentSize = stringLength(*(argv + index)) + 1 + sizeof(char*);
+            if (size + argumentSize > budget || argumentSize > 32 * sysconf(_SC_PAGESIZE)) {
+                break;
+            }
+            *(command->argv + fixedCount + chunkCount) = *(argv + index);
+            size += argumentSize;
+            chunkCount++;
+            index++;
+        }
+        if (index < count && chunkCount == 0) {
+            fprintf(stderr, "batch: argument too long: %.32s...\n", *(argv + index));
+            if (!status) {
+                status = 1;
             }
+            break;
+        }
+        *(command->argv + fixedCount + chunkCount) = NULL;
+        *(command->argc) = fixedCount + chunkCount + 1;
 
-            printf("background pid is %d\n", pid);
-            fflush(stdout);
+        if (*(command->isBackground)) {
+            runExternalCommandBackground(command, shell);
+        } else if (slots > 1) {
+            status = runBatchChunk(command, shell, slots, status);
+        } else {
+            runExternalCommandForeground(command, shell);
+            if (*(shell->status) && !status) {
+                status = *(shell->status);
+            }
+        }
+    } while (index < count);
 
-            *(shell->isRunningBackgroundProcess) = 1;
+    if (slots > 1 && !*(command->isBackground)) {
+        status = runBatchChunk(NULL, shell, slots, status);
+    }
+
+    free(command->argv);
+    command->argv = argv;
+    *(command->argc) = argc;
+
+    if (!*(command->isBackground)) {
+        *(shell->status) = status;
+        *(shell->isTimedOut) = 0;
+    }
+}
+
+/*
+ * Start one chunk of a parallel batch, waiting for a free slot first.
+ *
+ * The running chunks are tracked in a static table of pids and pidfds, and a
+ * slot is freed by polling the pidfds together. Without pidfd support the
+ * table is swept with WNOHANG instead. Passing a null command waits for every
+ * running chunk. Return the first failing status so far.
+ */
+int runBatchChunk(struct Command *command, struct Shell *shell, int slots, int status) {
+    static pid_t *pids = NULL;
+    static struct pollfd *pidfds = NULL;
+    static int running = 0;
+    int limit = slots;
+    int timeout = 0;
+    int result = 0;
+    int chunkStatus = 0;
+    pid_t pid = 0;
+
+    if (pids == NULL) {
+        pids = malloc(sizeof(pid_t) * slots);
+        pidfds = malloc(sizeof(struct pollfd) * slots);
+    }
+
+    if (command == NULL) {
+        limit = 1;
+    }
+
+    while (running >= limit) {
+        timeout = -1;
+        for (int i = 0; i < running; i++) {
+            if ((pidfds + i)->fd == -1) {
+                timeout = 50;
+            }
+        }
+        result = poll(pidfds, running, timeout);
+        if (result == -1 && errno == EINTR) {
+            continue;
+        }
+        for (int i = 0; i < running; i++) {
+            if (result > 0 && !((pidfds + i)->revents & (POLLIN | POLLNVAL))) {
+                continue;
+            }
+            pid = waitpid(*(pids + i), &chunkStatus, result > 0 ? 0 : WNOHANG);
+            if (pid <= 0) {
+                continue;
+            }
+            if (WIFSIGNALED(chunkStatus)) {
+                printf("pid %d terminated by signal %d\n", pid, chunkStatus);
+                fflush(stdout);
+            }
+            if (chunkStatus && !status) {
+                status = chunkStatus;
+            }
+            if ((pidfds + i)->fd != -1) {
+                close((pidfds + i)->fd);
+            }
+            running--;
+            *(pids + i) = *(pids + running);
+            *(pidfds + i) = *(pidfds + running);
+            i--;
+        }
+    }
+
+    if (command == NULL) {
+        free(pids);
+        free(pidfds);
+        pids = NULL;
+        pidfds = NULL;
+        return status;
+    }
+
+    fflush(stdout);
+    pid = fork();
+    switch (pid) {
+        case -1:
+            perror("fork()");
+            if (!status) {
+                status = 1;
+            }
+            break;
+        case 0:
+            signal(SIGINT, SIG_DFL);
+            execExternalCommand(command, shell);
+            break;
+        default:
+            *(pids + running) = pid;
+            (pidfds + running)->fd = openPidfd(pid);
+            (pidfds + running)->events = POLLIN;
+            (pidfds + running)->revents = 0;
+            running++;
+            break;
+    }
+
+    return status;
+}
+
+/*
+ * Run a command template over many inputs in parallel, and write the output
+ * of the jobs in input order.
+ *
+ * pmap [-j N] [-b BYTES] cmd [args...] [::: inputs...]
+ *
+ * Each input replaces every {} in the template, or is appended to it if
+ * there is no {}. Without :::, the inputs are the lines of stdin. Up to N
+ * jobs run at once, one per online CPU by default. See runPmapJobs() for how
+ * their output is ordered. The status is that of the first job, in input
+ * order, to fail.
+ */
+void runBuiltinCommandPmap(struct Command *command, struct Shell *shell) {
+    char **argv = command->argv;
+    char **inputs;
+    int count = countArguments(argv);
+    int slots = sysconf(_SC_NPROCESSORS_ONLN);
+    int index = 1;
+    int separator = 0;
+    int inputCount = 0;
+    int status = 0;
+    long limit = 16 * 1024 * 1024;
+
+    for (; index + 1 < count && **(argv + index) == '-'; index += 2) {
+        if (isEqualString(*(argv + index), "-j")) {
+            slots = atoi(*(argv + index + 1));
+        } else if (isEqualString(*(argv + index), "-b")) {
+            limit = parseSize(*(argv + index + 1));
+        } else {
+            break;
+        }
+    }
+    for (separator = index; separator < count; separator++) {
+        if (isEqualString(*(argv + separator), ":::")) {
+            break;
+        }
+    }
+    if (slots < 1 || limit < 1 || separator == index || **(argv + index) == '-') {
+        fprintf(stderr, "pmap: usage: pmap [-j N] [-b bytes] cmd [args...] [::: inputs...]\n");
+        *(shell->status) = 1;
+        *(shell->isTimedOut) = 0;
+        return;
+    }
+    if (*(command->isBackground)) {
+        fprintf(stderr, "pmap: jobs are ordered by the shell, so pmap runs in the foreground only\n");
+        *(shell->status) = 1;
+        *(shell->isTimedOut) = 0;
+        return;
+    }
+
+    if (separator < count) {
+        inputs = argv + separator + 1;
+        inputCount = count - separator - 1;
+    } else {
+        inputs = readPmapInputs(command, shell, &inputCount);
+    }
+
+    status = runPmapJobs(command, shell, argv + index, separator - index, inputs, inputCount, slots, limit);
+
+    if (separator == count) {
+        for (int i = 0; i < inputCount; i++) {
+            free(*(inputs + i));
+        }
+        free(inputs);
+    }
+    *(shell->status) = status;
+    *(shell->isTimedOut) = 0;
+}
+
+/*
+ * Read the non-empty lines of stdin as pmap inputs.
+ *
+ * A redirected stdin is read through its descriptor, as the stdio buffer of
+ * stdin still belongs to the shell's own input. Otherwise, the lines that
+ * the lookahead already read from a script come first, then lines are read
+ * until end-of-file, which is then cleared so that the shell can go on
+ * reading commands from a terminal.
+ *
+ * Return a dynamically allocated vector of dynamically allocated lines.
+ */
+char **readPmapInputs(struct Command *command, struct Shell *shell, int *count) {
+    MEMSTATS_SCOPE(MEMSTATS_JOBS);
+    char **inputs = malloc(sizeof(char*));
+    char *data = NULL;
+    char *buffer = NULL;
+    char *line = NULL;
+    char *saveptr;
+    size_t length = 0;
+
+    *count = 0;
+    if (*(command->isStdinRedirection) || *(command->isHereDocument)) {
+        data = readFileDescriptor(STDIN_FILENO);
+        for (line = strtok_r(data, "\n", &saveptr); data != NULL && line != NULL; line = strtok_r(NULL, "\n", &saveptr)) {
+            inputs = realloc(inputs, sizeof(char*) * (*count + 1));
+            *(inputs + *count) = malloc(sizeof(char) * (stringLength(line) + 1));
+            copyString(line, *(inputs + *count));
+            *count += 1;
+        }
+        free(data);
+        return inputs;
+    }
+
+    for (line = takeLookaheadLine(shell->lookahead); line != NULL; line = takeLookaheadLine(shell->lookahead)) {
+        if (*line == '\0') {
+            free(line);
+            continue;
+        }
+        inputs = realloc(inputs, sizeof(char*) * (*count + 1));
+        *(inputs + *count) = line;
+        *count += 1;
+    }
+    while (getline(&buffer, &length, stdin) != -1) {
+        *(buffer + strcspn(buffer, "\n")) = '\0';
+        if (*buffer == '\0') {
+            continue;
+        }
+        inputs = realloc(inputs, sizeof(char*) * (*count + 1));
+        *(inputs + *count) = malloc(sizeof(char) * (stringLength(buffer) + 1));
+        copyString(buffer, *(inputs + *count));
+        *count += 1;
+    }
+    memstatsFreeUntracked(buffer);
+    clearerr(stdin);
+
+    return inputs;
+}
+
+/*
+ * Run one job per input over a number of slots, streaming the output of the
+ * jobs to stdout in input order.
+ *
+ * Every job writes to its own pipe, and the pipes and pidfds of the jobs are
+ * polled together. The output of the oldest job that has not finished, the
+ * head, goes straight to stdout. The output of later jobs is kept in
+ * per-job buffers, and written as soon as every job before them has
+ * finished. Once limit bytes are buffered, only the head is read, so the
+ * later jobs block on their full pipes until the head catches up. Jobs
+ * whose pidfd could not be opened are swept every 50 ms instead.
+ *
+ * Return the status of the first job, in input order, to fail.
+ */
+int runPmapJobs(struct Command *command, struct Shell *shell, char **template, int templateCount, char **inputs, int inputCount, int slots, long limit) {
+    MEMSTATS_SCOPE(MEMSTATS_JOBS);
+    struct PmapJob *jobs = calloc(inputCount + 1, sizeof(struct PmapJob));
+    struct pollfd *fds = malloc(sizeof(struct pollfd) * (2 * inputCount + 1));
+    struct PmapJob *job;
+    int *owners = malloc(sizeof(int) * (2 * inputCount + 1));
+    int devNull = open(shell->devNull, O_RDONLY | O_CLOEXEC);
+    int launched = 0;
+    int running = 0;
+    int head = 0;
+    int status = 0;
+    int pollCount = 0;
+    int timeout = 0;
+    long buffered = 0;
+    long length = 0;
+    char chunk[65536];
+
+    fflush(stdout);
+    while (head < inputCount) {
+        for (; running < slots && launched < inputCount; launched++) {
+            if (startPmapJob(command, shell, jobs + launched, template, templateCount, *(inputs + launched), devNull) == 0) {
+                running++;
+            }
+        }
+
+        while (head < launched && (jobs + head)->outputFd == -1 && (jobs + head)->isExited) {
+            job = jobs + head;
+            if (WIFSIGNALED(job->status)) {
+                printf("pid %d terminated by signal %d\n", job->pid, job->status);
+                fflush(stdout);
+            }
+            if (job->status && !status) {
+                status = job->status;
+            }
+            head++;
+            job = jobs + head;
+            if (head < launched && job->length > 0) {
+                writeFileDescriptor(STDOUT_FILENO, job->buffer, job->length);
+                buffered -= job->length;
+                free(job->buffer);
+                job->buffer = NULL;
+                job->length = 0;
+                job->capacity = 0;
+            }
+        }
+        if (head == launched) {
+            continue;
+        }
+
+        pollCount = 0;
+        timeout = -1;
+        for (int i = head; i < launched; i++) {
+            job = jobs + i;
+            if (job->outputFd != -1 && (i == head || buffered < limit)) {
+                (fds + pollCount)->fd = job->outputFd;
+                (fds + pollCount)->events = POLLIN;
+                *(owners + pollCount) = i;
+                pollCount++;
+            }
+            if (!job->isExited && job->pidfd != -1) {
+                (fds + pollCount)->fd = job->pidfd;
+                (fds + pollCount)->events = POLLIN;
+                *(owners + pollCount) = i;
+                pollCount++;
+            } else if (!job->isExited) {
+                timeout = 50;
+            }
+        }
+
+        if (poll(fds, pollCount, timeout) == -1 && errno != EINTR) {
+            perror("poll()");
+            timeout = 50;
+        }
+
+        for (int i = 0; i < pollCount; i++) {
+            job = jobs + *(owners + i);
+            if (!(fds + i)->revents) {
+                continue;
+            }
+            if ((fds + i)->fd == job->outputFd) {
+                length = read(job->outputFd, chunk, sizeof(chunk));
+                if (length > 0 && *(owners + i) == head) {
+                    writeFileDescriptor(STDOUT_FILENO, chunk, length);
+                } else if (length > 0) {
+                    if (job->length + length > job->capacity) {
+                        job->capacity = (job->length + length) * 2;
+                        job->buffer = realloc(job->buffer, job->capacity);
+                    }
+                    memcpy(job->buffer + job->length, chunk, length);
+                    job->length += length;
+                    buffered += length;
+                } else if (length == 0 || (errno != EINTR && errno != EAGAIN)) {
+                    close(job->outputFd);
+                    job->outputFd = -1;
+                }
+            } else if (waitpid(job->pid, &(job->status), WNOHANG) > 0) {
+                job->isExited = 1;
+                close(job->pidfd);
+                job->pidfd = -1;
+                running--;
+            }
+        }
+
+        for (int i = head; timeout != -1 && i < launched; i++) {
+            job = jobs + i;
+            if (!job->isExited && job->pidfd == -1 && waitpid(job->pid, &(job->status), WNOHANG) > 0) {
+                job->isExited = 1;
+                running--;
+            }
+        }
+    }
+
+    if (devNull != -1) {
+        close(devNull);
+    }
+    free(jobs);
+    free(fds);
+    free(owners);
+
+    return status;
+}
+
+/*
+ * Start the pmap job for one input, with its stdout on a new pipe and its
+ * stdin on /dev/null.
+ *
+ * If the job could not be started, mark it as finished with a status of 1
+ * and return -1. Otherwise, return 0.
+ */
+int startPmapJob(struct Command *command, struct Shell *shell, struct PmapJob *job, char **template, int templateCount, char *input, int devNull) {
+    char **argv = command->argv;
+    char **jobArgv = buildPmapArgv(template, templateCount, input);
+    int output[2] = {-1, -1};
+
+    job->pid = -1;
+    job->outputFd = -1;
+    job->pidfd = -1;
+    job->isExited = 1;
+    job->status = 1;
+
+    if (pipe2(output, O_CLOEXEC) == -1) {
+        perror("pipe2()");
+    } else {
+        command->argv = jobArgv;
+        job->pid = fork();
+        switch (job->pid) {
+            case -1:
+                perror("fork()");
+                close(*output);
+                close(*(output + 1));
+                break;
+            case 0:
+                signal(SIGINT, SIG_DFL);
+                dup2(*(output + 1), STDOUT_FILENO);
+                if (devNull != -1) {
+                    dup2(devNull, STDIN_FILENO);
+                }
+                execExternalCommand(command, shell);
+                break;
+            default:
+                close(*(output + 1));
+                job->outputFd = *output;
+                job->pidfd = openPidfd(job->pid);
+                job->isExited = 0;
+                job->status = 0;
+                break;
+        }
+        command->argv = argv;
+    }
+
+    for (int i = 0; *(jobArgv + i) != NULL; i++) {
+        free(*(jobArgv + i));
+    }
+    free(jobArgv);
+
+    return job->isExited ? -1 : 0;
+}
+
+/*
+ * Build the argument vector of a pmap job by replacing every {} in the
+ * template with input, or by appending input if the template has no {}.
+ *
+ * Return a dynamically allocated, null-terminated vector of dynamically
+ * allocated strings.
+ */
+char **buildPmapArgv(char **template, int templateCount, char *input) {
+    char **argv = malloc(sizeof(char*) * (templateCount + 2));
+    int inputLength = stringLength(input);
+    int isReplaced = 0;
+    int length = 0;
+    int index = 0;
+    char *word;
+    char *match;
+
+    for (int i = 0; i < templateCount; i++) {
+        word = *(template + i);
+        length = stringLength(word);
+        for (match = strstr(word, "{}"); match != NULL; match = strstr(match + 2, "{}")) {
+            length += inputLength - 2;
+        }
+        *(argv + i) = malloc(sizeof(char) * (length + 1));
+        index = 0;
+        while (*word != '\0') {
+            if (*word == '{' && *(word + 1) == '}') {
+                copyString(input, *(argv + i) + index);
+                index += inputLength;
+                word += 2;
+                isReplaced = 1;
+            } else {
+                *(*(argv + i) + index) = *word;
+                index++;
+                word++;
+            }
+        }
+        *(*(argv + i) + index) = '\0';
+    }
+
+    *(argv + templateCount) = NULL;
+    if (!isReplaced) {
+        *(argv + templateCount) = malloc(sizeof(char) * (inputLength + 1));
+        copyString(input, *(argv + templateCount));
+    }
+    *(argv + templateCount + 1) = NULL;
+
+    return argv;
+}
+
+/*
+ * Run a command, then run it again every time one of the watched paths
+ * changes.
+ *
+ * watch [-r] [-d DURATION] [-n COUNT] PATHS... -- cmd...
+ *
+ * With -r, directories are watched recursively, including directories that
+ * are created later. Events that arrive within DURATION of each other, 100 ms
+ * by default, are coalesced into a single run. A change that arrives while
+ * the command is still running in the foreground cancels it, so that it is
+ * restarted with the latest files. With -n, stop after COUNT runs. SIGINT
+ * stops the watch.
+ */
+void runBuiltinCommandWatch(struct Command *command, struct Shell *shell) {
+    struct Watch watch;
+    struct sigaction SIGINT_action = {0};
+    struct sigaction previousAction;
+    char **argv = command->argv;
+    int count = countArguments(argv);
+    int isRecursive = 0;
+    int debounce = 100;
+    int limit = 0;
+    int runs = 0;
+    int index = 1;
+    int separator = 0;
+    int pathCount = 0;
+    int pendingCount = 0;
+    int isFailed = 0;
+    int fd = -1;
+
+    while (index < count && **(argv + index) == '-' && !isEqualString(*(argv + index), "--")) {
+        if (isEqualString(*(argv + index), "-r")) {
+            isRecursive = 1;
+        } else if (isEqualString(*(argv + index), "-d") && index + 1 < count) {
+            index++;
+            debounce = parseDuration(*(argv + index));
+        } else if (isEqualString(*(argv + index), "-n") && index + 1 < count) {
+            index++;
+            limit = atoi(*(argv + index));
+        } else {
+            debounce = -1;
+            break;
+        }
+        index++;
+    }
+    for (separator = index; separator < count; separator++) {
+        if (isEqualString(*(argv + separator), "--")) {
             break;
+        }
+    }
+    if (debounce == -1 || limit < 0 || separator == index || separator + 1 >= count) {
+        fprintf(stderr, "usage: watch [-r] [-d duration] [-n count] paths... -- cmd...\n");
+        *(shell->status) = 1;
+        *(shell->isTimedOut) = 0;
+        return;
+    }
+
+    fd = inotify_init1(IN_CLOEXEC | IN_NONBLOCK);
+    watch.fd = &fd;
+    watch.isRecursive = &isRecursive;
+    watch.pathCount = &pathCount;
+    watch.paths = NULL;
+    watch.pendingCount = &pendingCount;
+    watch.pending = NULL;
+    if (*(watch.fd) == -1) {
+        perror("watch");
+        isFailed = 1;
+    }
+    for (int i = index; i < separator && !isFailed; i++) {
+        if (addWatch(&watch, *(argv + i)) == -1) {
+            perror(*(argv + i));
+            isFailed = 1;
+        }
+    }
+
+    if (!isFailed) {
+        g_isInterrupted = 0;
+        SIGINT_action.sa_handler = handle_SIGINT;
+        sigfillset(&SIGINT_action.sa_mask);
+        SIGINT_action.sa_flags = 0;
+        sigaction(SIGINT, &SIGINT_action, &previousAction);
+
+        while (!g_isInterrupted) {
+            *(shell->watchFd) = *(watch.fd);
+            runPrefixedCommand(command, shell, separator + 1);
+            *(shell->watchFd) = -1;
+            fflush(stdout);
+            runs++;
+            if ((limit && runs >= limit) || waitForChange(&watch, debounce) == -1) {
+                break;
+            }
+        }
+
+        sigaction(SIGINT, &previousAction, NULL);
+    } else {
+        *(shell->status) = 1;
+        *(shell->isTimedOut) = 0;
+    }
+
+    for (int i = 0; i < pathCount; i++) {
+        free(*(watch.paths + i));
+    }
+    free(watch.paths);
+    for (int i = 0; i < pendingCount; i++) {
+        free(*(watch.pending + i));
+    }
+    free(watch.pending);
+    if (*(watch.fd) != -1) {
+        close(*(watch.fd));
+    }
+}
+
+/*
+ * Add an inotify watch for path, and for every directory below it if the
+ * watch is recursive.
+ *
+ * Paths are kept by watch descriptor so that directories created later can
+ * be watched relative to their parent. Directories below path that cannot be
+ * watched are skipped.
+ *
+ * If path itself cannot be watched, return -1. Otherwise, return 0.
+ */
+int addWatch(struct Watch *watch, char *path) {
+    int mask = IN_MODIFY | IN_CLOSE_WRITE | IN_ATTRIB | IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF;
+    int wd = inotify_add_watch(*(watch->fd), path, mask);
+    struct dirent *entry;
+    struct stat info;
+    char *child;
+    DIR *dir;
+
+    if (wd == -1) {
+        return -1;
+    }
+    if (wd >= *(watch->pathCount)) {
+        watch->paths = realloc(watch->paths, sizeof(char*) * (wd + 1));
+        for (int i = *(watch->pathCount); i <= wd; i++) {
+            *(watch->paths + i) = NULL;
+        }
+        *(watch->pathCount) = wd + 1;
+    }
+    free(*(watch->paths + wd));
+    *(watch->paths + wd) = malloc(sizeof(char) * (stringLength(path) + 1));
+    copyString(path, *(watch->paths + wd));
+
+    if (!*(watch->isRecursive) || (dir = opendir(path)) == NULL) {
+        return 0;
+    }
+    while ((entry = readdir(dir)) != NULL) {
+        if (isEqualString(entry->d_name, ".") || isEqualString(entry->d_name, "..")) {
+            continue;
+        }
+        child = joinPath(path, entry->d_name);
+        if (entry->d_type == DT_DIR || (entry->d_type == DT_UNKNOWN && lstat(child, &info) == 0 && S_ISDIR(info.st_mode))) {
+            addWatch(watch, child);
+        }
+        free(child);
+    }
+    closedir(dir);
+
+    return 0;
+}
+
+/*
+ * Block until a watched path changes, then keep draining events until none
+ * arrive for debounce ms.
+ *
+ * New directories below a recursive watch are watched as they appear. A path
+ * that is replaced, e.g. by an editor that saves by renaming a new file over
+ * it, loses its watch and is watched again. If the path is missing at that
+ * moment, it is retried every debounce ms until it reappears.
+ *
+ * If the wait was interrupted or failed, return -1. Otherwise, return 0.
+ */
+int waitForChange(struct Watch *watch, int debounce) {
+    struct pollfd pollFd = {0};
+    struct inotify_event *event;
+    char buffer[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    char *path;
+    int isChanged = 0;
+    int timeout = -1;
+    int result = 0;
+    int length = 0;
+
+    pollFd.fd = *(watch->fd);
+    pollFd.events = POLLIN;
+    while (!g_isInterrupted) {
+        timeout = -1;
+        if (isChanged) {
+            timeout = debounce;
+        } else if (*(watch->pendingCount) > 0) {
+            timeout = debounce > 0 ? debounce : 100;
+        }
+        result = poll(&pollFd, 1, timeout);
+        if (result == 0 && retryWatches(watch) > 0) {
+            isChanged = 1;
+        } else if (result == 0 && isChanged) {
+            return 0;
+        } else if (result == 0) {
+            continue;
+        } else if (result == -1 && errno != EINTR) {
+            return -1;
+        } else if (result == -1) {
+            continue;
+        }
+        while ((length = read(*(watch->fd), buffer, sizeof(buffer))) > 0) {
+            for (int i = 0; i < length; i += sizeof(struct inotify_event) + event->len) {
+                event = (struct inotify_event*) (buffer + i);
+                isChanged = 1;
+                if (*(watch->isRecursive) && (event->mask & IN_ISDIR) && (event->mask & (IN_CREATE | IN_MOVED_TO)) &&
+                    event->len > 0 && event->wd < *(watch->pathCount) && *(watch->paths + event->wd) != NULL) {
+                    path = joinPath(*(watch->paths + event->wd), event->name);
+                    addWatch(watch, path);
+                    free(path);
+                }
+                if (event->mask & IN_MOVE_SELF) {
+                    inotify_rm_watch(*(watch->fd), event->wd);
+                }
+                if (event->mask & IN_IGNORED) {
+                    rewatchPath(watch, event->wd);
+                }
+            }
+        }
+    }
+
+    return -1;
+}
+
+/*
+ * Watch the path of a watch descriptor that the kernel has dropped, because
+ * its file was deleted, or was moved away and unwatched on IN_MOVE_SELF.
+ *
+ * If the path cannot be watched yet, it is kept pending, unless it lies
+ * below a recursively watched directory, which watches it again if it is
+ * created.
+ */
+void rewatchPath(struct Watch *watch, int wd) {
+    char *path;
+
+    if (wd < 0 || wd >= *(watch->pathCount) || *(watch->paths + wd) == NULL) {
+        return;
+    }
+    path = *(watch->paths + wd);
+    *(watch->paths + wd) = NULL;
+
+    if (addWatch(watch, path) == 0 || hasWatchedParent(watch, path)) {
+        free(path);
+        return;
+    }
+    watch->pending = realloc(watch->pending, sizeof(char*) * (*(watch->pendingCount) + 1));
+    *(watch->pending + *(watch->pendingCount)) = path;
+    *(watch->pendingCount) += 1;
+}
+
+/*
+ * Try again to watch every pending path.
+ *
+ * Return the number of paths that are watched again.
+ */
+int retryWatches(struct Watch *watch) {
+    int count = 0;
+    int i = 0;
+
+    while (i < *(watch->pendingCount)) {
+        if (addWatch(watch, *(watch->pending + i)) == -1) {
+            i++;
+            continue;
+        }
+        free(*(watch->pending + i));
+        *(watch->pendingCount) -= 1;
+        *(watch->pending + i) = *(watch->pending + *(watch->pendingCount));
+        count++;
+    }
+
+    return count;
+}
+
+/*
+ * Check whether path lies directly in a directory that is watched
+ * recursively.
+ *
+ * If it does, return 1. Otherwise, return 0.
+ */
+int hasWatchedParent(struct Watch *watch, char *path) {
+    char *slash = strrchr(path, '/');
+    int length = slash != NULL ? slash - path : 0;
+    char *parent;
+
+    if (!*(watch->isRecursive) || slash == NULL) {
+        return 0;
+    }
+    for (int i = 0; i < *(watch->pathCount); i++) {
+        parent = *(watch->paths + i);
+        if (parent != NULL && stringLength(parent) == length && strncmp(parent, path, length) == 0) {
+            return 1;
+        }
     }
+    return 0;
 }
 
 /*
@@ -676,5 +2795,13 @@ void handle_SIGTSTP(int signal) {
         g_isPreventingBackgroundProcess = 1;
         message = "\nEntering foreground-only mode (& is now ignored)";
     }
+    setBoardForegroundOnly(g_isPreventingBackgroundProcess);
     write(STDOUT_FILENO, message, stringLength(message));
 }
+
+/*
+ * Record that SIGINT arrived while a builtin was waiting for it.
+ */
+void handle_SIGINT(int signal) {
+    g_isInterrupted = 1;
+}
@@ -1,32 +1,57 @@
 #ifndef SMALLSH_H
 #define SMALLSH_H
 
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <signal.h>
+#include <sys/inotify.h>
+#include <sys/mman.h>
 #include <sys/signal.h>
 #include <sys/wait.h>
 #include <unistd.h>
 
+#include "board.h"
+#include "cgroup.h"
+#include "environment.h"
+#include "lookahead.h"
+#include "memstats.h"
+
 /*
  *
  */
 
+extern char **environ;
+
 int g_isPreventingBackgroundProcess;
 
 struct Shell {
     int **backgroundPids;
     int *backgroundPidCount;
     int *MAX_LENGTH;
+    int *GRACE_PERIOD;
     int *STDIN_FD;
     int *STDOUT_FD;
     int *isRunning;
     int *isRunningBackgroundProcess;
     int *status;
+    int *isTimedOut;
+    int *timeout;
+    int *watchFd;
     int *pid;
     char *cwd;
     char *HOME;
     char *devNull;
+    struct Environment *environment;
+    struct Board *board;
+    struct Cgroup *cgroup;
+    struct Lookahead *lookahead;
 };
 
 struct Command {
@@ -35,16 +60,41 @@ struct Command {
     int *isStdinRedirection;
     int *isStdoutRedirection;
     int *isFailedRedirection;
+    int *isHereDocument;
     int *stdinFileArg;
     int *stdoutFileArg;
+    int *timeout;
     int *argc;
     int *wordc;
     char **argv;
     char **wordv;
+    char **envp;
+    char *hereDocument;
+    struct Limits *limits;
     FILE *stdinFile;
     FILE *stdoutFile;
 };
 
+struct PmapJob {
+    pid_t pid;
+    int outputFd;
+    int pidfd;
+    int isExited;
+    int status;
+    char *buffer;
+    long length;
+    long capacity;
+};
+
+struct Watch {
+    int *fd;
+    int *isRecursive;
+    int *pathCount;
+    char **paths;
+    int *pendingCount;
+    char **pending;
+};
+
 /*
  * The following functions relate to shell activities.
  */
@@ -57,8 +107,14 @@ void freeShell(struct Shell *shell);
 
 void checkBackgroundPids(struct Shell *shell);
 
+int findBackgroundPid(struct Shell *shell, pid_t pid);
+
+void removeBackgroundPid(struct Shell *shell, int index);
+
 void redirectStdin(struct Command *command, struct Shell *shell);
 
+void readHereDocument(struct Command *command, struct Shell *shell);
+
 void redirectStdout(struct Command *command, struct Shell *shell);
 
 void closeFiles(struct Command *command);
@@ -79,10 +135,24 @@ void printCommand(struct Command *command);
 
 void parseCommand(char *buffer, struct Command *command, struct Shell *shell);
 
+int findSubstitution(char *buffer, int length);
+
+char *parseSubstitution(char *buffer, int length, struct Shell *shell);
+
+char *appendExpansion(char *result, int *resultLength, char *buffer, int length, struct Shell *shell);
+
+void saveSubstitution(char *result, struct Command *command, struct Shell *shell, int *wordc, int *argc, int isCommand);
+
+char *captureCommand(char *line, struct Shell *shell);
+
+int isInProcessBuiltin(struct Command *command);
+
 char *parseExpansion(char *buffer, struct Shell *shell);
 
 void saveCommand(char *buffer, struct Command *command, struct Shell *shell, int index, int count, int wordc, int argc, int isCommand);
 
+void saveWord(char *str, struct Command *command, int wordc, int argc, int isCommand);
+
 void addNullToCommandVector(struct Command *command);
 
 void freeCommand(struct Command *command);
@@ -95,14 +165,76 @@ void runBuiltinCommand(struct Command *command, struct Shell *shell);
 
 void runBuiltinCommandExit(struct Command *command, struct Shell *shell);
 
+void terminateBackgroundPids(struct Shell *shell);
+
 void runBuiltinCommandCd(struct Command *command, struct Shell *shell);
 
 void runBuiltinCommandStatus(struct Command *command, struct Shell *shell);
 
+void runBuiltinCommandTimeout(struct Command *command, struct Shell *shell);
+
+void runPrefixedCommand(struct Command *command, struct Shell *shell, int shift);
+
+int countArguments(char **argv);
+
+void runBuiltinCommandExport(struct Command *command, struct Shell *shell);
+
+void runBuiltinCommandUnset(struct Command *command, struct Shell *shell);
+
+void runBuiltinCommandAssignment(struct Command *command, struct Shell *shell);
+
+void syncShellVariable(char *entry, struct Shell *shell);
+
+void runBuiltinCommandMemstats(struct Command *command, struct Shell *shell);
+
+void runBuiltinCommandPwd(struct Command *command, struct Shell *shell);
+
+void runBuiltinCommandLimit(struct Command *command, struct Shell *shell);
+
+void runBuiltinCommandJobs(struct Command *command, struct Shell *shell);
+
+void runBuiltinCommandWait(struct Command *command, struct Shell *shell);
+
+struct Limits *getJobLimits(struct Command *command, struct Shell *shell);
+
+void enterJobCgroup(int *sync);
+
+void placeJobCgroup(pid_t pid, struct Limits *limits, int *sync, struct Shell *shell);
+
 void runExternalCommandForeground(struct Command *command, struct Shell *shell);
 
 void runExternalCommandBackground(struct Command *command, struct Shell *shell);
 
+int waitForegroundPid(pid_t pid, int timeout, int cancelFd, struct Shell *shell);
+
+void execExternalCommand(struct Command *command, struct Shell *shell);
+
+void runBuiltinCommandBatch(struct Command *command, struct Shell *shell);
+
+int runBatchChunk(struct Command *command, struct Shell *shell, int slots, int status);
+
+void runBuiltinCommandPmap(struct Command *command, struct Shell *shell);
+
+char **readPmapInputs(struct Command *command, struct Shell *shell, int *count);
+
+int runPmapJobs(struct Command *command, struct Shell *shell, char **template, int templateCount, char **inputs, int inputCount, int slots, long limit);
+
+int startPmapJob(struct Command *command, struct Shell *shell, struct PmapJob *job, char **template, int templateCount, char *input, int devNull);
+
+char **buildPmapArgv(char **template, int templateCount, char *input);
+
+void runBuiltinCommandWatch(struct Command *command, struct Shell *shell);
+
+int addWatch(struct Watch *watch, char *path);
+
+int waitForChange(struct Watch *watch, int debounce);
+
+void rewatchPath(struct Watch *watch, int wd);
+
+int retryWatches(struct Watch *watch);
+
+int hasWatchedParent(struct Watch *watch, char *path);
+
 /*
  * The following functions relate to signals.
  */
@@ -111,4 +243,6 @@ void installSignals(void);
 
 void handle_SIGTSTP(int signal);
 
+void handle_SIGINT(int signal);
+
 #endif
\ No newline at end of file
@@ -0,0 +1,235 @@
+#include <dirent.h>
+#include <errno.h>
+#include <signal.h>
+#include <string.h>
+
+#include "board.h"
+
+/*
+ * The smallshmon file reads the boards that smallsh processes publish under
+ * /dev/shm and prints one line per shell.
+ *
+ * Every board is mapped once and kept mapped between polls, so a poll costs
+ * one directory scan plus one memory copy per shell, with no signals or
+ * round-trips to the shells themselves.
+ */
+
+struct Monitor {
+    pid_t pid;
+    int isSeen;
+    struct Board *board;
+};
+
+void printUsage(char *name);
+
+int scanBoards(struct Monitor **monitors, int *count, pid_t *pids, int pidCount);
+
+struct Board *mapBoard(pid_t pid);
+
+void printBoards(struct Monitor *monitors, int count, int isListingJobs);
+
+/*
+ * Print the boards once, or every interval seconds with -i.
+ */
+int main(int argc, char **argv) {
+    struct Monitor *monitors = NULL;
+    pid_t *pids = NULL;
+    double interval = 0;
+    int isListingJobs = 0;
+    int pidCount = 0;
+    int count = 0;
+    int option = 0;
+
+    while ((option = getopt(argc, argv, "i:jh")) != -1) {
+        switch (option) {
+            case 'i':
+                interval = atof(optarg);
+                break;
+            case 'j':
+                isListingJobs = 1;
+                break;
+            default:
+                printUsage(*argv);
+                return option == 'h' ? 0 : 1;
+        }
+    }
+
+    pidCount = argc - optind;
+    pids = malloc(sizeof(pid_t) * (pidCount + 1));
+    for (int i = 0; i < pidCount; i++) {
+        *(pids + i) = atoi(*(argv + optind + i));
+    }
+
+    do {
+        scanBoards(&monitors, &count, pids, pidCount);
+        printBoards(monitors, count, isListingJobs);
+        if (interval > 0) {
+            printf("\n");
+            fflush(stdout);
+            usleep(interval * 1000000);
+        }
+    } while (interval > 0);
+
+    for (int i = 0; i < count; i++) {
+        munmap((monitors + i)->board, sizeof(struct Board));
+    }
+    free(monitors);
+    free(pids);
+
+    return 0;
+}
+
+/*
+ * Print the command line options.
+ */
+void printUsage(char *name) {
+    fprintf(stderr, "usage: %s [-i seconds] [-j] [pid...]\n", name);
+    fprintf(stderr, "  -i  poll every interval seconds instead of printing once\n");
+    fprintf(stderr, "  -j  list the background jobs of every shell\n");
+}
+
+/*
+ * Bring the set of mapped boards up to date.
+ *
+ * Boards are found by scanning /dev/shm, or taken from pids if any were
+ * given. New boards are mapped, and boards whose file is gone are unmapped.
+ *
+ * Return the number of mapped boards.
+ */
+int scanBoards(struct Monitor **monitors, int *count, pid_t *pids, int pidCount) {
+    DIR *dir = NULL;
+    struct dirent *entry;
+    struct Monitor *monitor;
+    pid_t pid = 0;
+    int index = 0;
+    int isFound = 0;
+
+    for (int i = 0; i < *count; i++) {
+        (*monitors + i)->isSeen = 0;
+    }
+
+    if (pidCount == 0) {
+        dir = opendir("/dev/shm");
+        if (dir == NULL) {
+            perror("/dev/shm");
+            return 0;
+        }
+    }
+
+    while (1) {
+        if (dir != NULL) {
+            entry = readdir(dir);
+            if (entry == NULL) {
+                break;
+            }
+            if (strncmp(entry->d_name, "smallsh.", 8) != 0) {
+                continue;
+            }
+            pid = atoi(entry->d_name + 8);
+        } else {
+            if (index == pidCount) {
+                break;
+            }
+            pid = *(pids + index);
+            index++;
+        }
+
+        isFound = 0;
+        for (int i = 0; i < *count; i++) {
+            if ((*monitors + i)->pid == pid) {
+                (*monitors + i)->isSeen = 1;
+                isFound = 1;
+                break;
+            }
+        }
+        if (isFound || pid <= 0) {
+            continue;
+        }
+
+        *monitors = realloc(*monitors, sizeof(struct Monitor) * (*count + 1));
+        monitor = *monitors + *count;
+        monitor->pid = pid;
+        monitor->isSeen = 1;
+        monitor->board = mapBoard(pid);
+        if (monitor->board != NULL) {
+            *count += 1;
+        }
+    }
+
+    if (dir != NULL) {
+        closedir(dir);
+    }
+
+    for (int i = 0; i < *count; i++) {
+        if (!(*monitors + i)->isSeen) {
+            munmap((*monitors + i)->board, sizeof(struct Board));
+            *(*monitors + i) = *(*monitors + *count - 1);
+            *count -= 1;
+            i--;
+        }
+    }
+
+    return *count;
+}
+
+/*
+ * Map the board of the shell with the given pid read-only.
+ *
+ * If the board does not exist, return NULL.
+ */
+struct Board *mapBoard(pid_t pid) {
+    char name[64];
+    struct Board *board;
+    struct stat info;
+    int fd = -1;
+
+    getBoardName(pid, name, sizeof(name));
+    fd = shm_open(name, O_RDONLY | O_CLOEXEC, 0);
+    if (fd == -1) {
+        return NULL;
+    }
+    if (fstat(fd, &info) == -1 || info.st_size < sizeof(struct Board)) {
+        close(fd);
+        return NULL;
+    }
+
+    board = mmap(NULL, sizeof(struct Board), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+
+    return board == MAP_FAILED ? NULL : board;
+}
+
+/*
+ * Print one line per board, and optionally its background jobs.
+ *
+ * A shell whose pid no longer exists left its board behind when it was
+ * killed, and is marked as gone.
+ */
+void printBoards(struct Monitor *monitors, int count, int isListingJobs) {
+    struct Board snapshot;
+    char *state;
+
+    printf("%-8s %-5s %-10s %-7s %-6s %s\n", "PID", "STATE", "STATUS", "FGONLY", "JOBS", "FOREGROUND");
+    for (int i = 0; i < count; i++) {
+        if (readBoard((monitors + i)->board, &snapshot) == -1) {
+            printf("%-8d %-5s\n", (monitors + i)->pid, "busy");
+            continue;
+        }
+        state = "up";
+        if (kill(snapshot.shellPid, 0) == -1 && errno == ESRCH) {
+            state = "gone";
+        }
+        printf("%-8d %-5s %-4d%-6s %-7s %-6d %s\n", snapshot.shellPid, state, snapshot.status,\
+        snapshot.isTimedOut ? " (to)" : "", snapshot.isForegroundOnly ? "yes" : "no",\
+        snapshot.jobCount + snapshot.jobOverflow, snapshot.foregroundPid ? snapshot.foreground : "-");
+        if (isListingJobs) {
+            for (int j = 0; j < snapshot.jobCount && j < BOARD_JOB_COUNT; j++) {
+                printf("    %-8d %s\n", (snapshot.jobs + j)->pid, (snapshot.jobs + j)->command);
+            }
+            if (snapshot.jobOverflow > 0) {
+                printf("    ... %d more\n", snapshot.jobOverflow);
+            }
+        }
+    }
+    fflush(stdout);
+}
@@ -142,4 +142,221 @@ int isValidFile(char *filename, char *mode) {
     } else {
         return 0;
     }
-}
\ No newline at end of file
+}
+
+/*
+ * Convert a duration such as 10, 1.5s, 250ms, 2m or 1h to milliseconds.
+ *
+ * A number without a suffix is interpreted as seconds.
+ *
+ * If the duration is malformed or negative, return -1.
+ */
+int parseDuration(char *str) {
+    char *suffix = NULL;
+    double value = strtod(str, &suffix);
+    double multiplier = 0;
+
+    if (suffix == str || value < 0) {
+        return -1;
+    }
+
+    if (isEqualString(suffix, "") || isEqualString(suffix, "s")) {
+        multiplier = 1000;
+    } else if (isEqualString(suffix, "ms")) {
+        multiplier = 1;
+    } else if (isEqualString(suffix, "m")) {
+        multiplier = 60 * 1000;
+    } else if (isEqualString(suffix, "h")) {
+        multiplier = 60 * 60 * 1000;
+    } else {
+        return -1;
+    }
+
+    if (value * multiplier > 2147483647) {
+        return -1;
+    }
+
+    return (int) (value * multiplier);
+}
+
+/*
+ * Convert a size such as 512, 64K, 1.5M or 2G to bytes.
+ *
+ * Suffixes are powers of 1024 and may be lower case.
+ *
+ * If the size is malformed or negative, return -1.
+ */
+long parseSize(char *str) {
+    char *suffix = NULL;
+    double value = strtod(str, &suffix);
+    double multiplier = 0;
+
+    if (suffix == str || value < 0) {
+        return -1;
+    }
+
+    if (isEqualString(suffix, "")) {
+        multiplier = 1;
+    } else if (isEqualString(suffix, "K") || isEqualString(suffix, "k")) {
+        multiplier = 1024.0;
+    } else if (isEqualString(suffix, "M") || isEqualString(suffix, "m")) {
+        multiplier = 1024.0 * 1024;
+    } else if (isEqualString(suffix, "G") || isEqualString(suffix, "g")) {
+        multiplier = 1024.0 * 1024 * 1024;
+    } else if (isEqualString(suffix, "T") || isEqualString(suffix, "t")) {
+        multiplier = 1024.0 * 1024 * 1024 * 1024;
+    } else {
+        return -1;
+    }
+
+    return (long) (value * multiplier);
+}
+
+/*
+ * Get the time of a monotonic clock in milliseconds.
+ *
+ * The value is only meaningful when compared against another call.
+ */
+long getMonotonicMilliseconds(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+/*
+ * Open a file descriptor that refers to the process pid.
+ *
+ * The descriptor becomes readable when the process terminates, so it can be
+ * polled alongside other descriptors without reaping the process.
+ *
+ * If the kernel does not support pidfds, return -1 with errno set to ENOSYS.
+ */
+int openPidfd(pid_t pid) {
+#ifdef SYS_pidfd_open
+    return syscall(SYS_pidfd_open, pid, 0);
+#else
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+/*
+ * Get the number of bytes a null-terminated vector of strings occupies when
+ * passed to exec, i.e. every string with its null-terminator plus one pointer
+ * per string and one for the terminating null pointer.
+ */
+long getVectorSize(char **vector) {
+    long size = sizeof(char*);
+    for (int i = 0; *(vector + i) != NULL; i++) {
+        size += stringLength(*(vector + i)) + 1 + sizeof(char*);
+    }
+    return size;
+}
+
+/*
+ * Create a sealed, memory-backed file holding length bytes of data.
+ *
+ * The file never touches a filesystem and disappears once its last
+ * descriptor is closed. It is sealed against writes and resizing, and the
+ * returned descriptor is positioned at the start, so readers can seek freely.
+ *
+ * On failure, return -1 with errno set.
+ */
+int createMemoryFile(char *name, char *data, int length) {
+    int fd = memfd_create(name, MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    int written = 0;
+    int result = 0;
+
+    if (fd == -1) {
+        return -1;
+    }
+
+    while (written < length) {
+        result = write(fd, data + written, length - written);
+        if (result == -1 && errno != EINTR) {
+            close(fd);
+            return -1;
+        } else if (result > 0) {
+            written += result;
+        }
+    }
+
+    fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL);
+    lseek(fd, 0, SEEK_SET);
+
+    return fd;
+}
+
+/*
+ * Read from fd until end-of-file into a null-terminated character array.
+ *
+ * The array starts small and doubles in size as needed.
+ *
+ * Return the dynamically allocated array, or NULL if reading fails.
+ */
+char *readFileDescriptor(int fd) {
+    int size = 256;
+    int length = 0;
+    int result = 0;
+    char *buffer = malloc(sizeof(char) * size);
+
+    while (1) {
+        if (length == size - 1) {
+            size *= 2;
+            buffer = realloc(buffer, sizeof(char) * size);
+        }
+        result = read(fd, buffer + length, size - 1 - length);
+        if (result == 0) {
+            break;
+        } else if (result == -1 && errno != EINTR) {
+            free(buffer);
+            return NULL;
+        } else if (result > 0) {
+            length += result;
+        }
+    }
+    *(buffer + length) = '\0';
+
+    return buffer;
+}
+
+/*
+ * Join a directory and a file name with a slash between them.
+ *
+ * Return the dynamically allocated path.
+ */
+char *joinPath(char *directory, char *name) {
+    int directoryLength = stringLength(directory);
+    int nameLength = stringLength(name);
+    char *path = malloc(sizeof(char) * (directoryLength + nameLength + 2));
+
+    copyString(directory, path);
+    if (directoryLength > 0 && *(directory + directoryLength - 1) != '/') {
+        *(path + directoryLength) = '/';
+        directoryLength++;
+    }
+    copyString(name, path + directoryLength);
+
+    return path;
+}
+
+/*
+ * Write length bytes of data to fd, retrying after partial writes.
+ *
+ * If writing fails, return -1. Otherwise, return 0.
+ */
+int writeFileDescriptor(int fd, char *data, long length) {
+    long written = 0;
+    long result = 0;
+
+    while (written < length) {
+        result = write(fd, data + written, length - written);
+        if (result == -1 && errno != EINTR) {
+            return -1;
+        } else if (result > 0) {
+            written += result;
+        }
+    }
+
+    return 0;
+}
@@ -1,14 +1,24 @@
 #ifndef UTIL_H
 #define UTIL_H
 
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
 #include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <sys/syscall.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <time.h>
 #include <unistd.h>
 
+#include "memstats.h"
+
 /*
  * The util file contains helper functions to be used by smallsh.
  */
@@ -27,4 +37,22 @@ int parseString(char *pattern, char *string);
 
 int isValidFile(char *filename, char *mode);
 
+int parseDuration(char *str);
+
+long parseSize(char *str);
+
+long getMonotonicMilliseconds(void);
+
+int openPidfd(pid_t pid);
+
+long getVectorSize(char **vector);
+
+int createMemoryFile(char *name, char *data, int length);
+
+char *readFileDescriptor(int fd);
+
+int writeFileDescriptor(int fd, char *data, long length);
+
+char *joinPath(char *directory, char *name);
+
 #endif
\ No newline at end of file